@@ -0,0 +1,411 @@
+/*
+ *  BKmdaPianoCompressedBank.cpp
+ *  mda-vst3
+ *
+ *  帧格式（按 32 位字对齐，位流高位在前）：
+ *    order 2 位、Rice 参数 k 5 位、下一个采样 16 位、前 order 个采样各 16 位原样，
+ *    其余采样的预测残差（0 阶：x，1 阶：x - x1，2 阶：x - 2 x1 + x2）zigzag 之后 Rice 编码：
+ *    u >> k 个 0、一个 1、u 的低 k 位。
+ *
+ */
+
+#include "BKmdaPianoCompressedBank.h"
+#include "BKmdaPianoSampleCache.h"
+#include "BKmdaPianoSampleMips.h"
+#include "BKmdaPianoTelemetry.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+static std::mutex& bankMutex ()
+{
+	static std::mutex m;
+	return m;
+}
+
+static std::map<const SampleBank*, CompressedBank*>& banks ()
+{
+	static std::map<const SampleBank*, CompressedBank*> b;
+	return b;
+}
+
+//-----------------------------------------------------------------------------
+static inline int32 leadingZeros (uint64 x)	//x != 0
+{
+#if defined (__GNUC__) || defined (__clang__)
+	return __builtin_clzll (x);
+#else
+	int32 n = 0;
+	while (!(x & 0x8000000000000000ULL)) { x <<= 1; n++; }
+	return n;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+class BitWriter
+{
+public:
+	BitWriter (std::vector<uint32>& out) : out (out), acc (0), bits (0) {}
+
+	void put (uint32 value, int32 n)	//n <= 32
+	{
+		if (n == 0)
+			return;
+		acc = (acc << n) | (n < 32 ? value & ((1u << n) - 1) : value);
+		bits += n;
+		if (bits >= 32)
+		{
+			bits -= 32;
+			out.push_back ((uint32)(acc >> bits));
+		}
+	}
+
+	void putRice (uint32 u, int32 k)
+	{
+		for (uint32 q = u >> k; ; q -= 32)
+		{
+			if (q < 32)
+			{
+				put (1, (int32)q + 1);
+				break;
+			}
+			put (0, 32);
+		}
+		put (u, k);
+	}
+
+	void flush ()
+	{
+		if (bits > 0)
+			out.push_back ((uint32)(acc << (32 - bits)));
+		acc = 0;
+		bits = 0;
+	}
+
+private:
+	std::vector<uint32>& out;
+	uint64 acc;
+	int32 bits;
+};
+
+//-----------------------------------------------------------------------------
+class BitReader
+{
+public:
+	BitReader (const uint32* in) : in (in), cache (0), bits (0) {}
+
+	uint32 get (int32 n)	//n <= 32
+	{
+		if (n == 0)
+			return 0;
+		refill ();
+		uint32 value = (uint32)(cache >> (64 - n));
+		cache <<= n;
+		bits -= n;
+		return value;
+	}
+
+	uint32 getRice (int32 k)
+	{
+		uint32 q = 0;
+		refill ();
+		while (!(cache >> 32))	//32 个以上的 0
+		{
+			q += 32;
+			cache <<= 32;
+			bits -= 32;
+			refill ();
+		}
+		int32 z = leadingZeros (cache);
+		cache <<= z + 1;
+		bits -= z + 1;
+		return ((q + (uint32)z) << k) | get (k);
+	}
+
+private:
+	void refill ()
+	{
+		//cache 高位对齐，保证至少 33 位有效；位流末尾留了两个字的余量
+		while (bits <= 32)
+		{
+			cache |= (uint64)*in++ << (32 - bits);
+			bits += 32;
+		}
+	}
+
+	const uint32* in;
+	uint64 cache;
+	int32 bits;
+};
+
+//-----------------------------------------------------------------------------
+static inline int32 predict (int32 order, int32 x1, int32 x2)
+{
+	return order == 0 ? 0 : order == 1 ? x1 : 2 * x1 - x2;
+}
+
+//-----------------------------------------------------------------------------
+CompressedBank* CompressedBank::acquire (SampleBank& bank)
+{
+	std::lock_guard<std::mutex> lock (bankMutex ());
+	auto it = banks ().find (&bank);
+	if (it != banks ().end ())
+	{
+		it->second->refCount++;
+		return it->second;
+	}
+
+	CompressedBank* compressed = new CompressedBank;
+	compressed->build (bank);
+	compressed->source = &bank;
+	compressed->refCount = 1;
+	banks ()[&bank] = compressed;
+	return compressed;
+}
+
+//-----------------------------------------------------------------------------
+void CompressedBank::release ()
+{
+	std::lock_guard<std::mutex> lock (bankMutex ());
+	if (--refCount > 0)
+		return;
+	banks ().erase (source);
+	delete this;
+}
+
+//-----------------------------------------------------------------------------
+void CompressedBank::build (SampleBank& bank)
+{
+	//音色库和各级降采样副本一起编码，副本的帧同样从 pos 和循环起点开始
+	SampleMips mips;
+	mips.build (bank, MDA_PIANO_MIP_LEVELS);
+	const short* waves = mips.samples.data ();
+	uint32 numSamples = (uint32)mips.samples.size ();
+	int32 numGroups = (int32)mips.keygroups.size ();
+	keygroups = mips.keygroups;
+	numBaseKeygroups = mips.numBaseKeygroups;
+	numMipLevels = mips.numLevels;
+	groups.resize (numGroups);
+
+	for (int32 k = 0; k < numGroups; k++)
+	{
+		const SampleBankKeygroup& g = keygroups[k];
+		Group& group = groups[k];
+		group.loopStart = std::max (g.pos, g.end - g.loop + 1);
+		int32 start[2] = {g.pos, group.loopStart};
+		int32 stop[2] = {group.loopStart, g.end + 2};	//插值会读到 end + 1
+		for (int32 s = 0; s < 2; s++)
+		{
+			group.firstFrame[s] = (int32)frames.size ();
+			for (int32 p = start[s]; p < stop[s]; p += kFrameSamples)
+				encodeFrame (waves, numSamples, p, std::min<int32> (kFrameSamples, stop[s] - p));
+			sourceSamples += (uint64)(stop[s] - start[s]);
+		}
+	}
+	stream.push_back (0);	//BitReader 预读的余量
+	stream.push_back (0);
+}
+
+//-----------------------------------------------------------------------------
+void CompressedBank::encodeFrame (const short* waves, uint32 numSamples, int32 first, int32 count)
+{
+	const short* x = waves + first;
+
+	//选总位数最少的预测阶数和 k：k 先按残差均值估计，再比较相邻的两个
+	int32 bestOrder = 0, bestK = 0;
+	uint64 bestBits = ~(uint64)0;
+	std::vector<uint32> u (count);
+	for (int32 order = 0; order <= 2; order++)
+	{
+		uint64 sum = 0;
+		for (int32 i = order; i < count; i++)
+		{
+			int32 e = x[i] - predict (order, i > 0 ? x[i - 1] : 0, i > 1 ? x[i - 2] : 0);
+			u[i] = ((uint32)e << 1) ^ (uint32)(e >> 31);
+			sum += u[i];
+		}
+		int32 n = std::max (1, count - order), guess = 0;
+		while (guess < 17 && ((uint64)n << (guess + 1)) <= sum) guess++;
+		for (int32 k = std::max (0, guess - 1); k <= std::min (17, guess + 1); k++)
+		{
+			uint64 total = 16 * (uint64)order;
+			for (int32 i = order; i < count; i++)
+				total += (u[i] >> k) + 1 + (uint64)k;
+			if (total < bestBits)
+			{
+				bestBits = total;
+				bestOrder = order;
+				bestK = k;
+			}
+		}
+	}
+
+	Frame frame;
+	frame.offset = (uint32)stream.size ();
+	frame.first = first;
+	frame.count = count;
+	frames.push_back (frame);
+
+	BitWriter out (stream);
+	out.put ((uint32)bestOrder, 2);
+	out.put ((uint32)bestK, 5);
+	out.put ((uint16)((uint32)(first + count) < numSamples ? waves[first + count] : 0), 16);
+	int32 i = 0;
+	for (; i < bestOrder && i < count; i++)
+		out.put ((uint16)x[i], 16);
+	for (; i < count; i++)
+	{
+		int32 e = x[i] - predict (bestOrder, i > 0 ? x[i - 1] : 0, i > 1 ? x[i - 2] : 0);
+		out.putRice (((uint32)e << 1) ^ (uint32)(e >> 31), bestK);
+	}
+	out.flush ();
+}
+
+//-----------------------------------------------------------------------------
+int32 CompressedBank::findFrame (int32 group, int32 p) const
+{
+	const Group& g = groups[group];
+	if (p < g.loopStart)
+		return g.firstFrame[0] + (p - keygroups[group].pos) / kFrameSamples;
+	return g.firstFrame[1] + (p - g.loopStart) / kFrameSamples;
+}
+
+//-----------------------------------------------------------------------------
+void CompressedBank::decodeFrame (int32 index, int16* dest) const
+{
+	const Frame& frame = frames[index];
+	BitReader in (stream.data () + frame.offset);
+	int32 order = (int32)in.get (2);
+	int32 k = (int32)in.get (5);
+	dest[frame.count] = (int16)in.get (16);
+
+	int32 i = 0;
+	for (; i < order && i < frame.count; i++)
+		dest[i] = (int16)in.get (16);
+
+	int32 x1 = i > 0 ? dest[i - 1] : 0, x2 = i > 1 ? dest[i - 2] : 0;
+	for (; i < frame.count; i++)
+	{
+		uint32 u = in.getRice (k);
+		int32 e = (int32)(u >> 1) ^ -(int32)(u & 1);
+		int32 x = e + (order == 0 ? 0 : order == 1 ? x1 : 2 * x1 - x2);
+		dest[i] = (int16)x;
+		x2 = x1;
+		x1 = x;
+	}
+}
+
+//-----------------------------------------------------------------------------
+uint64 CompressedBank::getBytes () const
+{
+	return stream.size () * sizeof (uint32) + frames.size () * sizeof (Frame)
+	     + groups.size () * sizeof (Group) + keygroups.size () * sizeof (SampleBankKeygroup);
+}
+
+//-----------------------------------------------------------------------------
+FrameCache::FrameCache ()
+: bank (nullptr)
+, numSlots (0)
+, clock (0)
+, timing (false)
+, decodedFrames (0)
+, decodeNs (0)
+, lookups (0)
+{
+}
+
+//-----------------------------------------------------------------------------
+void FrameCache::setup (const CompressedBank* compressed, int32 slots)
+{
+	bank = compressed;
+	numSlots = compressed ? slots : 0;
+	data.assign ((size_t)numSlots * (CompressedBank::kFrameSamples + 1), 0);
+	slotFrame.assign (numSlots, -1);
+	slotUse.assign (numSlots, 0);
+	frameSlot.assign (compressed ? compressed->getNumFrames () : 0, -1);
+	clock = 0;
+	resetStats ();
+}
+
+//-----------------------------------------------------------------------------
+void FrameCache::resetStats ()
+{
+	decodedFrames.store (0, std::memory_order_relaxed);
+	decodeNs.store (0, std::memory_order_relaxed);
+	lookups.store (0, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+int32 FrameCache::lookup (int32 frame)
+{
+	int32 slot = frameSlot[frame];
+	if (slot >= 0)
+		return slot;
+
+	//没解码过：换掉最久没用的槽位
+	slot = 0;
+	for (int32 s = 1; s < numSlots; s++)
+	{
+		if (slotUse[s] < slotUse[slot])
+			slot = s;
+	}
+	if (slotFrame[slot] >= 0)
+		frameSlot[slotFrame[slot]] = -1;
+
+	//只在打开计时时读时钟，关闭时解码不多花两次 telemetryNow ()
+	uint64 start = timing ? telemetryNow () : 0;
+	bank->decodeFrame (frame, &data[(size_t)slot * (CompressedBank::kFrameSamples + 1)]);
+	if (timing)
+		decodeNs.fetch_add (telemetryNow () - start, std::memory_order_relaxed);
+	decodedFrames.fetch_add (1, std::memory_order_relaxed);
+
+	slotFrame[slot] = frame;
+	frameSlot[frame] = slot;
+	return slot;
+}
+
+//-----------------------------------------------------------------------------
+int32 FrameCache::fetch (SampleCursor& cursor, int32 pos, const int16*& samples)
+{
+	//同一帧里连续读时只比较一次范围；换帧或者槽位被别的帧占了才查表
+	int32 frame = cursor.frame;
+	if (frame < 0 || pos < bank->getFrame (frame).first
+	    || pos >= bank->getFrame (frame).first + bank->getFrame (frame).count)
+	{
+		frame = bank->findFrame (cursor.group, pos);
+		cursor.frame = frame;
+		cursor.slot = -1;
+		lookups.fetch_add (1, std::memory_order_relaxed);
+	}
+	if (cursor.slot < 0 || slotFrame[cursor.slot] != frame)
+		cursor.slot = lookup (frame);
+	slotUse[cursor.slot] = ++clock;
+
+	const CompressedBank::Frame& f = bank->getFrame (frame);
+	samples = &data[(size_t)cursor.slot * (CompressedBank::kFrameSamples + 1) + (pos - f.first)];
+	return f.first + f.count - pos;
+}
+
+//-----------------------------------------------------------------------------
+void FrameCache::fill (SampleCursor& cursor, int32 pos, int32 end, int32 loop, int32 count, uint32* dest)
+{
+	while (count > 0)
+	{
+		while (pos > end) pos -= loop;
+		const int16* samples;
+		int32 n = std::min (std::min (fetch (cursor, pos, samples), count), end - pos + 1);
+		for (int32 i = 0; i < n; i++)
+			dest[i] = SampleCache::pack (samples[i], samples[i + 1]);
+		dest += n;
+		pos += n;
+		count -= n;
+	}
+}
+
+}}} // namespaces
@@ -0,0 +1,139 @@
+/*
+ *  BKmdaPianoCompressedBank.h
+ *  mda-vst3
+ *
+ *  可选的压缩采样存储（PianoProcessor::setCompressedSamples，默认值 MDA_PIANO_COMPRESSED_SAMPLES）。
+ *  每个键组分成两段：pos 到循环起点之前、循环起点到 end + 1，每段切成最多 kFrameSamples 个采样的帧，
+ *  所以帧总是从 pos 和循环起点开始，回绕后不会落在帧中间。每帧用 0~2 阶固定预测 + Rice 编码无损压缩，
+ *  可以单独解码（随机访问）。编码后的数据和 SampleCache 一样按音色库在进程内共享。
+ *
+ *  解码后的帧放在 FrameCache 里（每个处理器一个，LRU，只在音频线程上使用，不加锁），
+ *  同一键组上的声部读同一份解码结果。每个声部有一个 SampleCursor，记住上次读的帧和槽位，
+ *  连续读同一帧时不用查表。
+ *
+ */
+
+#pragma once
+
+#include "BKmdaPianoSampleBank.h"
+
+#include <atomic>
+#include <vector>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+class CompressedBank
+{
+public:
+	enum { kFrameSamples = 1024 };
+
+	struct Frame
+	{
+		uint32 offset;	//first word in the bit stream
+		int32 first;	//bank position of the first sample
+		int32 count;	//samples in the frame
+	};
+
+	// 非音频线程调用
+	static CompressedBank* acquire (SampleBank& bank);
+	void release ();
+
+	// 键组与音色库相同，位置是音色库里的位置；之后是各级降采样副本（SampleMips），
+	// 第 level 级的键组 k 在 [level * getNumKeygroups () + k]
+	const SampleBankKeygroup* getKeygroups () const { return keygroups.data (); }
+	int32 getNumKeygroups () const { return numBaseKeygroups; }
+	int32 getNumMipLevels () const { return numMipLevels; }
+	int32 getNumFrames () const { return (int32)frames.size (); }
+	const Frame& getFrame (int32 frame) const { return frames[frame]; }
+
+	// 键组 group 里包含位置 p（pos..end + 1）的帧
+	int32 findFrame (int32 group, int32 p) const;
+
+	// 解码一帧到 dest[0..count - 1]，dest[count] 是紧接着的下一个采样（插值跨帧读 p + 1 用）
+	void decodeFrame (int32 frame, int16* dest) const;
+
+	uint64 getBytes () const;	//encoded stream and tables
+	uint64 getSourceBytes () const { return sourceSamples * sizeof (int16); }	//16-bit samples covered by the frames
+
+private:
+	CompressedBank () : refCount (0), source (nullptr), sourceSamples (0), numBaseKeygroups (0), numMipLevels (1) {}
+	CompressedBank (const CompressedBank&) = delete;
+	CompressedBank& operator= (const CompressedBank&) = delete;
+
+	void build (SampleBank& bank);
+	void encodeFrame (const short* waves, uint32 numSamples, int32 first, int32 count);
+
+	struct Group
+	{
+		int32 loopStart;	//first position reached after a wrap
+		int32 firstFrame[2];	//[0] pos..loopStart - 1, [1] loopStart..end + 1
+	};
+
+	int32 refCount;
+	const SampleBank* source;
+	uint64 sourceSamples;
+	std::vector<uint32> stream;
+	std::vector<Frame> frames;
+	std::vector<Group> groups;
+	std::vector<SampleBankKeygroup> keygroups;
+	int32 numBaseKeygroups;
+	int32 numMipLevels;
+};
+
+//-----------------------------------------------------------------------------
+// 声部的解码位置：note-on 时 reset (键组)，之后由 FrameCache 更新
+struct SampleCursor
+{
+	int32 group;
+	int32 frame;	//last frame read, -1 = none
+	int32 slot;	//FrameCache slot that held it (checked before use, may have been evicted)
+
+	void reset (int32 keygroup) { group = keygroup; frame = slot = -1; }
+};
+
+//-----------------------------------------------------------------------------
+class FrameCache
+{
+public:
+	FrameCache ();
+
+	// 非音频线程：分配 numSlots 个解码帧的空间，清空统计；bank 为 nullptr 时释放
+	void setup (const CompressedBank* bank, int32 numSlots);
+
+	// 音频线程：把声部从 pos 开始的 count 个插值点（打包成 SampleCache 的格式）写到 dest，
+	// 越过 end 时按 loop 回绕，与 SampleCache 展开的保护区内容相同
+	void fill (SampleCursor& cursor, int32 pos, int32 end, int32 loop, int32 count, uint32* dest);
+
+	uint64 getBytes () const { return data.size () * sizeof (int16); }
+
+	// 音频线程：之后的解码是否计时（getDecodeNs），处理器每块按遥测开关设置
+	void setTiming (bool state) { timing = state; }
+
+	// 任意线程
+	uint64 getDecodedFrames () const { return decodedFrames.load (std::memory_order_relaxed); }
+	uint64 getDecodeNs () const { return decodeNs.load (std::memory_order_relaxed); }	//only while timing
+	uint64 getLookups () const { return lookups.load (std::memory_order_relaxed); }	//frame changes seen by cursors
+	void resetStats ();
+
+private:
+	int32 fetch (SampleCursor& cursor, int32 pos, const int16*& samples);
+	int32 lookup (int32 frame);
+
+	const CompressedBank* bank;
+	int32 numSlots;
+	std::vector<int16> data;	//numSlots * (kFrameSamples + 1)
+	std::vector<int32> slotFrame;	//frame held by each slot, -1 = empty
+	std::vector<uint64> slotUse;	//LRU stamp
+	std::vector<int32> frameSlot;	//slot holding each frame, -1 = not decoded
+	uint64 clock;
+	bool timing;
+
+	std::atomic<uint64> decodedFrames;
+	std::atomic<uint64> decodeNs;
+	std::atomic<uint64> lookups;
+};
+
+}}} // namespaces
@@ -0,0 +1,116 @@
+/*
+ *  BKmdaPianoDelayLine.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoDelayLine.h"
+
+#include <cstring>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+DelayLine::DelayLine ()
+: buffer (nullptr)
+, mask (0)
+, writePos (0)
+, delay (1)
+, frac (0.0f)
+{
+}
+
+//-----------------------------------------------------------------------------
+DelayLine::~DelayLine ()
+{
+	delete[] buffer;
+}
+
+//-----------------------------------------------------------------------------
+void DelayLine::setup (double sampleRate, double delaySeconds, bool fractional)
+{
+	double samples = sampleRate * delaySeconds;
+	if (samples < 1.0) samples = 1.0;
+	if (fractional)
+	{
+		delay = (int32)samples;
+		frac = (float)(samples - delay);
+	}
+	else
+	{
+		delay = (int32)(samples + 0.5);
+		frac = 0.0f;
+	}
+
+	//分数延迟要多读一个更早的采样
+	int32 length = 1;
+	while (length < delay + 2)
+		length <<= 1;
+	if (length != mask + 1 || buffer == nullptr)
+	{
+		delete[] buffer;
+		buffer = new float[length];
+		mask = length - 1;
+	}
+	clear ();
+}
+
+//-----------------------------------------------------------------------------
+void DelayLine::clear ()
+{
+	if (buffer)
+		memset (buffer, 0, sizeof (float) * (mask + 1));
+	writePos = 0;
+}
+
+//-----------------------------------------------------------------------------
+void DelayLine::write (const float* in, int32 frames)
+{
+	int32 first = mask + 1 - writePos;
+	if (first > frames) first = frames;
+	memcpy (buffer + writePos, in, sizeof (float) * first);
+	memcpy (buffer, in + first, sizeof (float) * (frames - first));
+	writePos = (writePos + frames) & mask;
+}
+
+//-----------------------------------------------------------------------------
+void DelayLine::read (float* out, int32 offset, int32 frames) const
+{
+	int32 pos = (writePos - offset) & mask;
+	int32 first = mask + 1 - pos;
+	if (first > frames) first = frames;
+	memcpy (out, buffer + pos, sizeof (float) * first);
+	memcpy (out + first, buffer, sizeof (float) * (frames - first));
+}
+
+//-----------------------------------------------------------------------------
+void DelayLine::process (const float* in, float* out, int32 frames)
+{
+	//每次最多处理 delay 帧：这一段要读的数据都是之前写入的，可以先整段读、再整段写
+	int32 chunk = delay;
+	while (frames > 0)
+	{
+		int32 n = frames < chunk ? frames : chunk;
+		if (frac == 0.0f)
+			read (out, delay, n);
+		else
+		{
+			//out = (1 - frac) * x[t - delay] + frac * x[t - delay - 1]
+			for (int32 f = 0; f < n; f++)
+			{
+				int32 pos = (writePos + f - delay) & mask;
+				float a = buffer[pos];
+				float b = buffer[(pos - 1) & mask];
+				out[f] = a + frac * (b - a);
+			}
+		}
+		write (in, n);
+		in += n;
+		out += n;
+		frames -= n;
+	}
+}
+
+}}} // namespaces
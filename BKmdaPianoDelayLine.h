@@ -0,0 +1,52 @@
+/*
+ *  BKmdaPianoDelayLine.h
+ *  mda-vst3
+ *
+ *  立体声模拟器用的延迟线。长度按采样率在 setup () 里分配（非音频线程），
+ *  延迟时间固定，不随采样率变化；可选分数延迟（线性插值）。
+ *  process () 按整块处理，只做 memcpy 和简单循环，音频线程上不分配内存。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+class DelayLine
+{
+public:
+	DelayLine ();
+	~DelayLine ();
+
+	// 非音频线程调用。fractional 为 false 时延迟取最接近的整数采样数
+	void setup (double sampleRate, double delaySeconds, bool fractional);
+	void clear ();
+
+	// out[f] = 延迟 getDelay () 个采样之前写入的 in；in 和 out 不能是同一块内存
+	void process (const float* in, float* out, int32 frames);
+
+	double getDelay () const { return delay + (double)frac; }
+	// 最后一个非零输入之后还要再送多少帧 0，输出才全部为 0
+	int32 getTailFrames () const { return delay + (frac > 0.0f ? 2 : 1); }
+	int32 getLength () const { return mask + 1; }
+
+private:
+	DelayLine (const DelayLine&) = delete;
+	DelayLine& operator= (const DelayLine&) = delete;
+
+	void write (const float* in, int32 frames);
+	void read (float* out, int32 offset, int32 frames) const;
+
+	float* buffer;
+	int32 mask;		//buffer length - 1, power of 2
+	int32 writePos;
+	int32 delay;	//whole samples
+	float frac;		//fractional part, 0 unless fractional
+};
+
+}}} // namespaces
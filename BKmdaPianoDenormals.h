@@ -0,0 +1,74 @@
+/*
+ *  BKmdaPianoDenormals.h
+ *  mda-vst3
+ *
+ *  在作用域内打开 flush-to-zero / denormals-are-zero，离开作用域时恢复宿主原来的设置。
+ *  x86 上次正规数的运算会慢几十倍。处理器在 env < SILENCE 时就移除声部，延迟线没有反馈，正常的延音尾巴到不了这个区间
+ *  （bench/BKmdaPianoDenormalBench.cpp 逐秒统计）；这里是保险，不依赖这些条件，也不依赖宿主线程原来的设置。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__SSE__) || (defined (_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MDA_DENORMALS_MXCSR 1
+#elif defined (__aarch64__) && !defined (_MSC_VER)
+#define MDA_DENORMALS_FPCR 1
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+// 小于这个值的滤波器/延迟状态直接当 0（约 -300 dB），用于没有 FTZ 的平台和跨块保存的状态
+static const float kDenormalFloor = 1.0e-15f;
+
+inline float flushDenormal (float x)
+{
+	return (x > -kDenormalFloor && x < kDenormalFloor) ? 0.0f : x;
+}
+
+//-----------------------------------------------------------------------------
+class ScopedNoDenormals
+{
+public:
+	ScopedNoDenormals ()
+	{
+#if MDA_DENORMALS_MXCSR
+		saved = _mm_getcsr ();
+		_mm_setcsr (saved | 0x8040);	//FTZ (bit 15) | DAZ (bit 6)
+#elif MDA_DENORMALS_FPCR
+		uint64 fpcr;
+		__asm__ __volatile__ ("mrs %0, fpcr" : "=r" (fpcr));
+		saved = fpcr;
+		fpcr |= (uint64)1 << 24;	//FZ
+		__asm__ __volatile__ ("msr fpcr, %0" : : "r" (fpcr));
+#endif
+	}
+
+	~ScopedNoDenormals ()
+	{
+#if MDA_DENORMALS_MXCSR
+		_mm_setcsr (saved);
+#elif MDA_DENORMALS_FPCR
+		uint64 fpcr = saved;
+		__asm__ __volatile__ ("msr fpcr, %0" : : "r" (fpcr));
+#endif
+	}
+
+private:
+	ScopedNoDenormals (const ScopedNoDenormals&) = delete;
+	ScopedNoDenormals& operator= (const ScopedNoDenormals&) = delete;
+
+#if MDA_DENORMALS_MXCSR
+	uint32 saved;
+#elif MDA_DENORMALS_FPCR
+	uint64 saved;
+#endif
+};
+
+}}} // namespaces
@@ -0,0 +1,150 @@
+/*
+ *  BKmdaPianoFaultMonitor.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoFaultMonitor.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MDA_SCAN_SSE2 1
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+static int32 clearSpan (float* x, int32 first, int32 count, float limit, int32& nans, int32& firstBad)
+{
+	int32 bad = 0;
+	for (int32 f = first; f < first + count; f++)
+	{
+		float v = x[f];
+		if (!(v > -limit) || !(v < limit))
+		{
+			if (f < firstBad) firstBad = f;
+			if (v != v) nans++;
+			bad++;
+			x[f] = 0.0f;
+		}
+	}
+	return bad;
+}
+
+//-----------------------------------------------------------------------------
+static int32 scanChannel (float* x, int32 frames, float limit, float& lo, float& hi, int32& nans, int32& firstBad)
+{
+	int32 f = 0, bad = 0;
+	lo = hi = 0.0f;
+
+#if MDA_SCAN_SSE2
+	const __m128 pos = _mm_set1_ps (limit), neg = _mm_set1_ps (-limit);
+	__m128 vlo = _mm_setzero_ps (), vhi = _mm_setzero_ps ();
+	for (; f + 4 <= frames; f += 4)
+	{
+		__m128 v = _mm_loadu_ps (x + f);
+		__m128 ok = _mm_and_ps (_mm_cmpgt_ps (v, neg), _mm_cmplt_ps (v, pos));
+		vlo = _mm_min_ps (v, vlo);	//NaN 在第一个操作数时返回第二个，不污染 min/max
+		vhi = _mm_max_ps (v, vhi);
+		if (_mm_movemask_ps (ok) != 0xF)	//几乎不会成立，分支预测总是命中
+			bad += clearSpan (x, f, 4, limit, nans, firstBad);
+	}
+	alignas (16) float t[4];
+	_mm_store_ps (t, vlo);
+	lo = std::min (std::min (t[0], t[1]), std::min (t[2], t[3]));
+	_mm_store_ps (t, vhi);
+	hi = std::max (std::max (t[0], t[1]), std::max (t[2], t[3]));
+#endif
+
+	int32 tail = f;
+	for (; f < frames; f++)
+	{
+		float v = x[f];
+		if (v < lo) lo = v;
+		if (v > hi) hi = v;
+	}
+	return bad + clearSpan (x, tail, frames - tail, limit, nans, firstBad);
+}
+
+//-----------------------------------------------------------------------------
+void scanAndClearBlock (float* l, float* r, int32 frames, float limit, BlockScan& result)
+{
+	result.nanSamples = 0;
+	result.firstBad = frames;
+	result.badSamples = scanChannel (l, frames, limit, result.minL, result.maxL, result.nanSamples, result.firstBad);
+	result.badSamples += scanChannel (r, frames, limit, result.minR, result.maxR, result.nanSamples, result.firstBad);
+}
+
+//-----------------------------------------------------------------------------
+FaultMonitor::FaultMonitor ()
+{
+	reset ();
+}
+
+//-----------------------------------------------------------------------------
+void FaultMonitor::reset ()
+{
+	for (auto& slot : history)
+	{
+		slot.seq.store (0, std::memory_order_relaxed);
+		for (auto& w : slot.words)
+			w.store (0, std::memory_order_relaxed);
+	}
+	writeCount.store (0, std::memory_order_relaxed);
+	faultBlocks.store (0, std::memory_order_relaxed);
+	badSamples.store (0, std::memory_order_relaxed);
+	nanSamples.store (0, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+void FaultMonitor::report (const FaultSnapshot& snapshot)
+{
+	uint64 words[kWords];
+	memcpy (words, &snapshot, sizeof (words));
+
+	//只有音频线程写，writeCount 不需要 RMW
+	uint64 index = writeCount.load (std::memory_order_relaxed);
+	Slot& slot = history[index & (kHistorySize - 1)];
+	uint32 seq = slot.seq.load (std::memory_order_relaxed);
+	slot.seq.store (seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_release);
+	for (int32 i = 0; i < kWords; i++)
+		slot.words[i].store (words[i], std::memory_order_relaxed);
+	slot.seq.store (seq + 2, std::memory_order_release);
+	writeCount.store (index + 1, std::memory_order_release);
+
+	faultBlocks.fetch_add (1, std::memory_order_relaxed);
+	badSamples.fetch_add ((uint64)snapshot.badSamples, std::memory_order_relaxed);
+	nanSamples.fetch_add ((uint64)snapshot.nanSamples, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+int32 FaultMonitor::getRecent (FaultSnapshot* dest, int32 maxCount) const
+{
+	uint64 written = writeCount.load (std::memory_order_acquire);
+	uint64 available = std::min<uint64> (written, kHistorySize);
+	int32 count = 0;
+
+	for (uint64 n = 1; n <= available && count < maxCount; n++)
+	{
+		const Slot& slot = history[(written - n) & (kHistorySize - 1)];
+		uint64 words[kWords];
+		uint32 before = slot.seq.load (std::memory_order_acquire);
+		if (before & 1)
+			continue;
+		for (int32 i = 0; i < kWords; i++)
+			words[i] = slot.words[i].load (std::memory_order_relaxed);
+		std::atomic_thread_fence (std::memory_order_acquire);
+		if (slot.seq.load (std::memory_order_relaxed) != before)
+			continue;
+		memcpy (&dest[count++], words, sizeof (words));
+	}
+	return count;
+}
+
+}}} // namespaces
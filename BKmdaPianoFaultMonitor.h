@@ -0,0 +1,88 @@
+/*
+ *  BKmdaPianoFaultMonitor.h
+ *  mda-vst3
+ *
+ *  音频线程上的异常值（NaN / 越界）检测与统计。
+ *  音频线程只做无锁的原子写，其他线程随时可以读计数和最近的故障快照，音频线程从不调用 stdio。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <atomic>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+// 一次故障的现场：哪个块、块内第一帧坏值的位置、当时的声部数和混音范围
+struct FaultSnapshot
+{
+	uint64 block;		//processed block counter
+	int32 frame;		//first bad frame inside the scanned span
+	int32 activeVoices;
+	int32 badSamples;	//out of range or NaN, both channels
+	int32 nanSamples;
+	float minL, maxL;
+	float minR, maxR;
+};
+
+//-----------------------------------------------------------------------------
+// 扫描结果：坏值个数、第一处坏值和取值范围。坏值已被原地清零。
+struct BlockScan
+{
+	int32 badSamples;
+	int32 nanSamples;
+	int32 firstBad;
+	float minL, maxL;
+	float minR, maxR;
+};
+
+// 向量化扫描一段混音：!(x > -limit) || !(x < limit) 的样本（包括 NaN）置 0。
+// 没有坏值时只有一次最终判断，没有逐样本分支。
+void scanAndClearBlock (float* l, float* r, int32 frames, float limit, BlockScan& result);
+
+//-----------------------------------------------------------------------------
+class FaultMonitor
+{
+public:
+	enum { kHistorySize = 16 };	//recent snapshots kept, power of 2
+
+	FaultMonitor ();
+
+	// 音频线程：无锁、无分配、不阻塞
+	void report (const FaultSnapshot& snapshot);
+
+	// 任意线程
+	uint64 getFaultBlocks () const { return faultBlocks.load (std::memory_order_relaxed); }
+	uint64 getBadSamples () const { return badSamples.load (std::memory_order_relaxed); }
+	uint64 getNaNSamples () const { return nanSamples.load (std::memory_order_relaxed); }
+
+	// 按从新到旧的顺序拷贝最多 maxCount 个快照，返回实际个数。
+	// 与 report 并发时，正在被改写的槽位会被跳过。
+	int32 getRecent (FaultSnapshot* dest, int32 maxCount) const;
+
+	void reset ();
+
+private:
+	enum { kWords = sizeof (FaultSnapshot) / sizeof (uint64) };
+	static_assert (sizeof (FaultSnapshot) % sizeof (uint64) == 0, "snapshot must pack into whole words");
+
+	// seqlock 槽位：seq 为奇数表示正在写
+	struct Slot
+	{
+		std::atomic<uint32> seq;
+		std::atomic<uint64> words[kWords];
+	};
+
+	Slot history[kHistorySize];
+	std::atomic<uint64> writeCount;
+	std::atomic<uint64> faultBlocks;
+	std::atomic<uint64> badSamples;
+	std::atomic<uint64> nanSamples;
+};
+
+}}} // namespaces
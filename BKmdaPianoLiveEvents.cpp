@@ -0,0 +1,71 @@
+/*
+ *  BKmdaPianoLiveEvents.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoLiveEvents.h"
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+LiveEventQueue::LiveEventQueue ()
+: pushed (0)
+, overflows (0)
+, late (0)
+, coalesced (0)
+, ring (kRingSize)
+{
+}
+
+//-----------------------------------------------------------------------------
+bool LiveEventQueue::push (const LiveEvent& event)
+{
+	if (!ring.push (event))
+	{
+		overflows.fetch_add (1, std::memory_order_relaxed);
+		return false;
+	}
+	pushed.fetch_add (1, std::memory_order_relaxed);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool LiveEventQueue::noteOn (double time, int32 channel, int32 pitch, float velocity, int32 noteId)
+{
+	LiveEvent e = {};
+	e.time = time;
+	e.type = LiveEvent::kNoteOn;
+	e.channel = channel;
+	e.pitch = pitch;
+	e.velocity = velocity;
+	e.noteId = noteId;
+	return push (e);
+}
+
+//-----------------------------------------------------------------------------
+bool LiveEventQueue::noteOff (double time, int32 channel, int32 pitch, int32 noteId)
+{
+	LiveEvent e = {};
+	e.time = time;
+	e.type = LiveEvent::kNoteOff;
+	e.channel = channel;
+	e.pitch = pitch;
+	e.noteId = noteId;
+	return push (e);
+}
+
+//-----------------------------------------------------------------------------
+bool LiveEventQueue::control (double time, ParamID id, ParamValue value)
+{
+	LiveEvent e = {};
+	e.time = time;
+	e.type = LiveEvent::kControl;
+	e.id = id;
+	e.value = value;
+	return push (e);
+}
+
+}}} // namespaces
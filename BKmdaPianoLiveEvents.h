@@ -0,0 +1,73 @@
+/*
+ *  BKmdaPianoLiveEvents.h
+ *  mda-vst3
+ *
+ *  独立渲染模式（没有宿主，本地 MIDI 线程直接驱动引擎）的事件输入。生产者线程把带时间戳的音符、
+ *  踏板和参数事件放进单生产者/单消费者环形缓冲（无锁、无分配），音频线程每块开始时取出本块之内到期的事件，
+ *  换算成 sampleOffset（PianoProcessor::drainLiveEvents）。环满时 push 返回 false 并计数，生产者和音频线程都不等待。
+ *
+ *  时间是渲染时钟上的秒数：PianoProcessor::getLiveTime () 是已经渲染的帧数 / 采样率，setActive 时归零。
+ *  生产者一般用 getLiveTime () 加上一个固定的提前量；时间 <= 0 表示尽快。事件按放入的顺序生效，
+ *  时间比前一个事件早的当作和前一个同时。
+ *
+ */
+
+#pragma once
+
+#include "BKmdaPianoSpscRing.h"
+#include "pluginterfaces/vst/vsttypes.h"
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+struct LiveEvent
+{
+	enum Type { kNoteOn, kNoteOff, kControl };
+
+	double time;	//seconds on the render clock, <= 0 = as soon as possible
+	int32 type;
+	int32 channel;	//part of a note event
+	int32 pitch;
+	float velocity;	//0..1
+	int32 noteId;	//pairs a note-off with its note-on
+	ParamID id;	//kControl: any ID PianoProcessor::setParameter accepts (parameters, program, mod wheel, sustain, part IDs)
+	ParamValue value;
+};
+
+//-----------------------------------------------------------------------------
+class LiveEventQueue
+{
+public:
+	enum { kRingSize = 1024 };	//events in flight, power of 2
+
+	LiveEventQueue ();
+
+	// 生产者线程（唯一）：环满时丢弃并返回 false
+	bool push (const LiveEvent& event);
+	bool noteOn (double time, int32 channel, int32 pitch, float velocity, int32 noteId);
+	bool noteOff (double time, int32 channel, int32 pitch, int32 noteId);
+	bool control (double time, ParamID id, ParamValue value);
+
+	// 音频线程（唯一的消费者）：下一个事件，没有时为 nullptr；处理完再 pop
+	const LiveEvent* peek () const { return ring.peek (); }
+	void pop () { ring.pop (); }
+	void addLate () { late.fetch_add (1, std::memory_order_relaxed); }
+	void addCoalesced () { coalesced.fetch_add (1, std::memory_order_relaxed); }
+
+	// 任意线程
+	uint64 getPushed () const { return pushed.load (std::memory_order_relaxed); }
+	uint64 getOverflows () const { return overflows.load (std::memory_order_relaxed); }	//pushes refused because the ring was full
+	uint64 getLate () const { return late.load (std::memory_order_relaxed); }	//events whose time had passed when the block started
+	uint64 getCoalesced () const { return coalesced.load (std::memory_order_relaxed); }	//repeated control values dropped
+
+private:
+	std::atomic<uint64> pushed;
+	std::atomic<uint64> overflows;
+	std::atomic<uint64> late;
+	std::atomic<uint64> coalesced;
+	SpscRing<LiveEvent> ring;
+};
+
+}}} // namespaces
@@ -80,18 +80,38 @@ Sustain (有一个开关图标):
 
 */
 
-#include "mdaPianoProcessor.h"
+#include "BKmdaPianoProcessor.h"
 #include "mdaPianoController.h"
-#include "mdaPianoData.h"
-
-#include <cstdio>
+#if !MDA_PIANO_NO_BUILTIN_BANK
+#include "BKmdaPianoBuiltinBank.h"
+#endif
+#include "BKmdaPianoDenormals.h"
+#include "BKmdaPianoDelayLine.h"
+#include "BKmdaPianoSampleBank.h"
+#include "pluginterfaces/base/ustring.h"
+#include "pluginterfaces/vst/ivstparameterchanges.h"
+
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 
 namespace Steinberg {
 namespace Vst {
 namespace mda {
 
 #define SILENCE 0.0001f  //voice choking
+#define SHED_TIME 0.005f  //fade-out time of voices shed by the voice budget, seconds
+#define SMOOTH_TIME 0.02  //time constant of the stereo width and muffle smoothing, seconds
+#define STEREO_DELAY (127.0 / 44100.0)  //stereo simulator delay, seconds (127 samples at 44.1 kHz)
+#ifndef MDA_PIANO_FRACTIONAL_DELAY
+#define MDA_PIANO_FRACTIONAL_DELAY 0  //1 = exact delay time at every rate (interpolated), 0 = nearest whole sample
+#endif
+#ifndef MDA_PIANO_DENORMAL_GUARD
+#define MDA_PIANO_DENORMAL_GUARD 1  //0 = no FTZ/DAZ scope and no state flushing, only as the baseline of bench/BKmdaPianoDenormalBench.cpp
+#endif
+
+static inline float guardDenormal (float x) { return MDA_PIANO_DENORMAL_GUARD ? flushDenormal (x) : x; }
 
 //-----------------------------------------------------------------------------
 float PianoProcessor::programParams[][NPARAMS] = { 
@@ -107,15 +127,71 @@ float PianoProcessor::programParams[][NPARAMS] = {
 
 //-----------------------------------------------------------------------------
 PianoProcessor::PianoProcessor ()
-: currentProgram (0)
+: kgrp (nullptr)
+, numKeygroups (0)
+, numMipLevels (1)
+, waves (nullptr)
+, waveRate (0.0f)
+, bank (nullptr)
+, sampleCache (nullptr)
+, compressedBank (nullptr)
+, stage (nullptr)
+, renderLimit (kBlockSize)
+, compressedSamples (MDA_PIANO_COMPRESSED_SAMPLES != 0)
+, controlChanges (kMinControlChanges)
+, numControlChanges (0)
+, controlOverflows (0)
+, numEarlyControls (0)
+, lostEarlyControls (0)
+, liveFrames (0)
+, tracing (false)
+, replayVoiceCap (-1)
+, voiceKernel (getVoiceKernel ())
+, blockCount (0)
+, blockStats ()
+, silentIn (0)
+, renderPool (nullptr)
+, renderThreads (MDA_PIANO_RENDER_THREADS)
+, groupMix (nullptr)
+, renderFrames (0)
 {
 	setControllerClass (PianoController::uid);
 	allocParameters (NPARAMS);
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		//第 0 个声部组合就是插件自己的参数，其余的参数只在处理器里
+		Part& P = parts[p];
+		P.params = p == 0 ? params : P.ownParams;
+		P.program = 0;
+		P.snapshot = &P.edited;
+		P.edited.Fs = 0.0f;
+		P.edited.volume = 0.2f;	//整体音量，原来在 initialize 里设置
+		P.cdep = 0.0f;
+		P.muffle = P.muffleTarget = 0.0;
+		P.pedal = 0.0f;
+		P.sustainValue = P.modWheelValue = -1.0;
+		P.voices = 0;
+		P.stereoTail = 0;
+		for (int32 i = 0; i < NPARAMS; i++)
+			P.edited.params[i] = -1.0;	//第一次 recalculate () 时全部重建
+	}
+	for (int32 n = 0; n < kNumPrograms; n++)
+	{
+		programs[n].Fs = 0.0f;
+		programs[n].volume = 0.2f;
+		for (int32 i = 0; i < NPARAMS; i++)
+			programs[n].params[i] = -1.0;	//buildPrograms () 时生成
+	}
+	voiceBudget.setEnabled (MDA_PIANO_ADAPTIVE_POLY != 0);
+	telemetry.setEnabled (MDA_PIANO_TELEMETRY != 0);
 }
 
 //-----------------------------------------------------------------------------
 PianoProcessor::~PianoProcessor ()
 {
+	if (renderPool) renderPool->release ();
+	delete[] groupMix;
+	delete[] stage;
 }
 
 //-----------------------------------------------------------------------------
@@ -126,12 +202,21 @@ tresult PLUGIN_API PianoProcessor::initialize (FUnknown* context)
 	{
 		addEventInput (USTRING("MIDI in"), 1);
 		addAudioOutput (USTRING("Stereo Out"), SpeakerArr::kStereo);
+		for (int32 p = 1; p < kNumParts; p++)
+		{
+			//多音色：每个声部组合一条辅助输出总线，宿主没有激活的总线混进主输出
+			char name[32];
+			snprintf (name, sizeof (name), "Part %d Out", p + 1);
+			addAudioOutput (UString128 (name), SpeakerArr::kStereo, kAux, 0);
+		}
 		// Fs设置采样率为44.1 kHz	
 		// iFs计算采样时间间隔（采样周期），即1秒内采样的次数的倒数
-		// cmax设定最大音量级别为127（标准MIDI最大值）
-		Fs = 44100.0f;  iFs = 1.0f/Fs;  cmax = 0x7F;  //just in case...
+		Fs = 44100.0f;  iFs = 1.0f/Fs;  //just in case...
 		//waves：这是一个指向波形数据的指针。pianoData：包含钢琴音色的波形数据。这行代码将 waves 指针初始化为指向 pianoData，从而在后续处理中使用这些波形数据来生成钢琴音色。
-		waves = pianoData;
+		//现在 waves/kgrp 指向音色库：优先用 MDA_PIANO_SAMPLE_BANK 指定的外部文件（只读 mmap，进程内所有实例共享），
+		//没有指定或加载失败时用编译进来的 pianoData。声部实际读的是由音色库生成的 SampleCache。
+		if (!acquireSampleBank ())
+			return kResultFalse;
 		/*存储在 pianoData(mdaPianoData.h) 数组中的音频样本。这些样本以 PCM 格式存储，用于再现钢琴的声音。每个样本值代表一个特定时间点上的音频信号的振幅
 		PCM（脉冲编码调制）数据是将模拟音频信号数字化的结果。在这种情况下，数组 pianoData 包含了短整型（short）值，这些值交替表示正和负的振幅，形成音频波形。
 		正值和负值：每个值表示在该采样点上的振幅（即音频信号的强度）。正值和负值表示振幅相对于中线的偏移方向。
@@ -139,7 +224,7 @@ tresult PLUGIN_API PianoProcessor::initialize (FUnknown* context)
 		使用这些数据再现声音，在合成器或音频处理器中，这些PCM数据将通过DAC（数模转换器）转换回模拟信号，驱动扬声器再现声音。
 		*/
 		
-		//Waveform data and keymapping is hard-wired in *this* version
+		//Waveform data and keymapping come from the sample bank (built-in: builtinKeygroups)
 		
 		/*
 		这段代码定义了钢琴键盘上的各个键组（keygroup）的波形数据和键映射。每个键组包含以下信息：
@@ -180,21 +265,6 @@ tresult PLUGIN_API PianoProcessor::initialize (FUnknown* context)
 		// ... 依次类推
 		每个键组覆盖2到3个音符，通过这种方式，15个键组就可以覆盖整个钢琴的88个音符。
 		*/
-		kgrp[ 0].root = 36;  kgrp[ 0].high = 37;  kgrp[ 0].pos = 0;       kgrp[ 0].end = 36275;   kgrp[ 0].loop = 14774;
-		kgrp[ 1].root = 40;  kgrp[ 1].high = 41;  kgrp[ 1].pos = 36278;   kgrp[ 1].end = 83135;   kgrp[ 1].loop = 16268;
-		kgrp[ 2].root = 43;  kgrp[ 2].high = 45;  kgrp[ 2].pos = 83137;   kgrp[ 2].end = 146756;  kgrp[ 2].loop = 33541;
-		kgrp[ 3].root = 48;  kgrp[ 3].high = 49;  kgrp[ 3].pos = 146758;  kgrp[ 3].end = 204997;  kgrp[ 3].loop = 21156;
-		kgrp[ 4].root = 52;  kgrp[ 4].high = 53;  kgrp[ 4].pos = 204999;  kgrp[ 4].end = 244908;  kgrp[ 4].loop = 17191;
-		kgrp[ 5].root = 55;  kgrp[ 5].high = 57;  kgrp[ 5].pos = 244910;  kgrp[ 5].end = 290978;  kgrp[ 5].loop = 23286;
-		kgrp[ 6].root = 60;  kgrp[ 6].high = 61;  kgrp[ 6].pos = 290980;  kgrp[ 6].end = 342948;  kgrp[ 6].loop = 18002;
-		kgrp[ 7].root = 64;  kgrp[ 7].high = 65;  kgrp[ 7].pos = 342950;  kgrp[ 7].end = 391750;  kgrp[ 7].loop = 19746;
-		kgrp[ 8].root = 67;  kgrp[ 8].high = 69;  kgrp[ 8].pos = 391752;  kgrp[ 8].end = 436915;  kgrp[ 8].loop = 22253;
-		kgrp[ 9].root = 72;  kgrp[ 9].high = 73;  kgrp[ 9].pos = 436917;  kgrp[ 9].end = 468807;  kgrp[ 9].loop = 8852;
-		kgrp[10].root = 76;  kgrp[10].high = 77;  kgrp[10].pos = 468809;  kgrp[10].end = 492772;  kgrp[10].loop = 9693;
-		kgrp[11].root = 79;  kgrp[11].high = 81;  kgrp[11].pos = 492774;  kgrp[11].end = 532293;  kgrp[11].loop = 10596;
-		kgrp[12].root = 84;  kgrp[12].high = 85;  kgrp[12].pos = 532295;  kgrp[12].end = 560192;  kgrp[12].loop = 6011;
-		kgrp[13].root = 88;  kgrp[13].high = 89;  kgrp[13].pos = 560194;  kgrp[13].end = 574121;  kgrp[13].loop = 3414;
-		kgrp[14].root = 93;  kgrp[14].high = 999; kgrp[14].pos = 574123;  kgrp[14].end = 586343;  kgrp[14].loop = 2399;
 
 		//initialise...
 		//synthData.numVoices=32，也就是最大32个复音。合成器可以在同一时间播放32个不同的音符。
@@ -206,36 +276,111 @@ tresult PLUGIN_API PianoProcessor::initialize (FUnknown* context)
 			//设置衰减参数，使所有音符的声音逐渐衰减，直至完全停止。这是为了确保在合成器初始化时，没有任何未结束的音符在播放。
 			synthData.voice[v].dec = 0.99f; //all notes off
 		}
-		//将音量设置为0.2。这是一个初始值，用于控制合成器输出音频的整体音量。
-		volume = 0.2f;
-		//这行代码将muff（可能是“muffle”的缩写）设置为160.0。它通常用于控制滤波器参数，使声音变得更加柔和或模糊。
-		muff = 160.0f;
-		//cpos可能是一个环形缓冲区的当前位置，用于处理音频数据。
-		//synthData.sustain：用于表示当前的延音状态，0表示没有延音。
+		for (int32 p = 0; p < kNumParts; p++)
+		{
+			Part& P = parts[p];
+			//这行代码将muff（可能是“muffle”的缩写）设置为160.0。它通常用于控制滤波器参数，使声音变得更加柔和或模糊。
+			P.muff = 160.0f;
+			//立体声模拟器的延迟线，setActive 时再按实际采样率重新分配
+			P.stereoDelay.setup (Fs, STEREO_DELAY, MDA_PIANO_FRACTIONAL_DELAY != 0);
+
+			/*
+			NPARAMS 表示参数的数量。
+			params[i] 是参数数组的第 i 个元素。
+			programParams[0][i] 是 programParams 数组的第0个程序的第 i 个参数值。
+			也就是初始化第一个program的参数（每个声部组合都从第一个program开始）。
+			*/
+			for (int32 i = 0; i < NPARAMS; i++)
+				P.params[i] = programParams[0][i];
+		}
+		//synthData.sustain：用于表示当前的延音状态，0表示没有延音（踏板状态现在在每个声部组合的 pedal 里）。
 		//synthData.activevoices：表示当前活跃的声部（voices）数量，0表示没有活跃的声部。
-		cpos = synthData.sustain = synthData.activevoices = 0;
-		//这行代码为一个浮点型数组 comb 分配256个元素的内存空间。这个数组可能用于存储和处理音频信号，例如用于延迟效果或滤波器。
-		comb = new float[256];
-
-		/*
-		NPARAMS 表示参数的数量。
-		params[i] 是参数数组的第 i 个元素。
-		programParams[0][i] 是 programParams 数组的第0个程序的第 i 个参数值。
-		也就是初始化第一个program的参数。
-		*/
-		for (int32 i = 0; i < NPARAMS; i++)
-			params[i] = programParams[0][i];
+		synthData.sustain = synthData.activevoices = 0;
+		clearVoiceIndex ();
 
+		buildPrograms ();
 		recalculate ();
+		snapControls ();
 	}
 	return res;
 }
 
+//-----------------------------------------------------------------------------
+bool PianoProcessor::acquireSampleBank ()
+{
+	if (bank)
+		return true;
+	if (const char* path = SampleBank::getDefaultPath ())
+		bank = SampleBank::acquire (path);	//失败时退回内置音色库
+#if !MDA_PIANO_NO_BUILTIN_BANK
+	if (!bank)
+		bank = SampleBank::acquireBuiltin (pianoData, (uint32)(sizeof (pianoData) / sizeof (pianoData[0])), kBuiltinSampleRate,
+		                                   builtinKeygroups, (int32)(sizeof (builtinKeygroups) / sizeof (builtinKeygroups[0])));
+#endif
+	if (!bank)
+		return false;
+
+	if (compressedSamples)
+	{
+		/*压缩存储：不生成展开的采样缓存。每次渲染前由 stageVoices 从解码帧里取出每个声部这一段要读的采样，
+		按 SampleCache 的格式放进 stage，内核照常从 waves 读。键组保持音色库里的位置。*/
+		compressedBank = CompressedBank::acquire (*bank);
+		kgrp = compressedBank->getKeygroups ();
+		numKeygroups = compressedBank->getNumKeygroups ();
+		numMipLevels = compressedBank->getNumMipLevels ();
+		frameCache.setup (compressedBank, kFrameCacheSlots);
+		if (!stage)
+			stage = new uint32[kNumVoices * kStageEntries];
+		memset (stage, 0, sizeof (uint32) * kNumVoices * kStageEntries);	//空声部读 waves[0]
+		waves = stage;
+	}
+	else
+	{
+		//声部读的是由音色库生成的采样缓存（相邻两点打包、循环段展开），映射的音色库只在这里读一遍
+		sampleCache = SampleCache::acquire (*bank);
+		kgrp = sampleCache->getKeygroups ();
+		numKeygroups = sampleCache->getNumKeygroups ();
+		numMipLevels = sampleCache->getNumMipLevels ();
+		waves = sampleCache->getSamples ();
+	}
+	waveRate = (float)bank->getSampleRate ();
+	//键组变了，所有快照都要重建：只清 Fs 只会重建和采样率有关的表，键组表（kSizeDirty）会留着旧音色库的，
+	//所以和构造函数一样把 params 清成 -1，下一次 updateSnapshot 时每个参数都算改过
+	for (int32 n = 0; n < kNumPrograms; n++)
+	{
+		for (int32 i = 0; i < NPARAMS; i++)
+			programs[n].params[i] = -1.0;
+	}
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		for (int32 i = 0; i < NPARAMS; i++)
+			parts[p].edited.params[i] = -1.0;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+uint64 PianoProcessor::getSampleMemory () const
+{
+	if (compressedBank)
+		return compressedBank->getBytes () + frameCache.getBytes () + sizeof (uint32) * kNumVoices * kStageEntries;
+	return sampleCache ? (uint64)sampleCache->getSize () * sizeof (uint32) : 0;
+}
+
 //-----------------------------------------------------------------------------
 tresult PLUGIN_API PianoProcessor::terminate ()
 {
-	if (comb) delete[] comb;
-	comb = nullptr;
+	if (renderPool) renderPool->release ();
+	renderPool = nullptr;
+	if (sampleCache) sampleCache->release ();	//先于音色库释放
+	sampleCache = nullptr;
+	frameCache.setup (nullptr, 0);
+	if (compressedBank) compressedBank->release ();
+	compressedBank = nullptr;
+	if (bank) bank->release ();
+	bank = nullptr;
+	kgrp = nullptr;
+	waves = nullptr;
 	return Base::terminate ();
 }
 
@@ -245,88 +390,426 @@ tresult PLUGIN_API PianoProcessor::setActive (TBool state)
 	//TBool state 是函数参数，表示插件的激活状态。true 表示激活，false 表示停用。
 	if (state)
 	{
+		//记录从这里开始：参数和排队的变化是 flushControls 之前的，重放时按同样的顺序生效
+		tracing = traceRecorder.isEnabled ();
+		if (tracing)
+		{
+			traceStart ();
+			if (earlyControls.size () < controlChanges.size ())
+				earlyControls.resize (controlChanges.size ());
+		}
+		numEarlyControls = lostEarlyControls = 0;	//停用时提前生效的已经在 start 记录的参数里
+		flushControls ();	//停用期间排队的参数变化直接生效
 		synthData.init ();
+		clearVoiceIndex ();
+		voiceBudget.reset (kNumVoices);
 		Fs = getSampleRate ();
 		iFs = 1.0f / Fs;
-		/*
-		根据采样率调整 cmax 参数：如果采样率大于 64 kHz，设置 cmax 为 0xFF（255）。否则，设置 cmax 为 0x7F（127）。
-		*/
-		if (Fs > 64000.0f) cmax = 0xFF; else cmax = 0x7F;
-		//将 comb 数组的内存清零。comb 数组的大小为 256 个浮点数，用于存储一些音频信号数据（例如延迟或滤波器的数据）。
-		memset (comb, 0, sizeof (float) * 256);
+		liveFrames.store (0, std::memory_order_relaxed);	//live events' clock starts over
+		buildPrograms ();	//采样率变了，重建所有程序的快照
+		recalculate ();
+		snapControls ();	//没有声部在响，平滑量直接到位
+		/*原来的 comb 固定 256 个 float，延迟是 cmax 个采样（64 kHz 以下 127，以上 255），
+		延迟时间随采样率变化（48 kHz 时 2.6 ms，96 kHz 时 2.7 ms，192 kHz 时只有 1.3 ms）。
+		现在按 STEREO_DELAY 秒计算长度，任何采样率下声像宽度一致；同时清空延迟线。*/
+		for (int32 p = 0; p < kNumParts; p++)
+		{
+			parts[p].stereoDelay.setup (Fs, STEREO_DELAY, MDA_PIANO_FRACTIONAL_DELAY != 0);
+			parts[p].stereoTail = 0;
+		}
+
+		//声部并行渲染：线程池（进程内共享）和每组的输出缓冲都在这里准备好，音频线程上不创建线程也不分配内存
+		if (renderThreads > 0 && !renderPool)
+		{
+			if (!groupMix)
+				groupMix = new LaneMix[kNumLaneGroups];
+			renderPool = RenderPool::acquire (renderThreads);
+		}
 	}
 	else
+	{
+		if (renderPool) renderPool->release ();
+		renderPool = nullptr;
 		allNotesOff ();
+	}
 	return Base::setActive (state);
 }
 
+//-----------------------------------------------------------------------------
+tresult PLUGIN_API PianoProcessor::setupProcessing (ProcessSetup& newSetup)
+{
+	/*参数队列按最大块长分配：宿主的自动化斜坡可以每个采样点一个点，块越长点越多。
+	除了每个参数固定的 kControlPoints 个点，再留出 kControlRamps 个参数同时逐采样变化的位置，
+	正常的自动化不会走到溢出（把最早的变化提前到块首）的路径。只增不减，停用时调用，音频线程上不分配。*/
+	size_t capacity = (size_t)kMinControlChanges + (size_t)kControlRamps * (size_t)std::max<int32> (0, newSetup.maxSamplesPerBlock);
+	if (capacity > controlChanges.size ())
+		controlChanges.resize (capacity);
+	return Base::setupProcessing (newSetup);
+}
+
 //-----------------------------------------------------------------------------
 void PianoProcessor::setParameter (ParamID index, ParamValue newValue, int32 sampleOffset)
 {
 	/*
 	ParamID index 是参数索引，用于指定要设置的参数。
 	ParamValue newValue 是新的参数值。
-	int32 sampleOffset 是样本偏移量，通常用于延迟设置参数的生效时间。
+	int32 sampleOffset 是样本偏移量，参数在块内这一采样点生效。
+	原来参数、预设和调制轮在块开始时就生效（预设切换还不调用 recalculate，调制轮只影响之后的新音符），
+	只有延音踏板按 sampleOffset 排队。现在这四类变化都按 sampleOffset 排进 controlChanges，
+	由 doProcessing 在对应的采样点调用 applyControl，和音符事件一样精确到采样。
+	多音色时 partParamID (part, ...) 换算成同样的四类变化，只作用于那个声部组合；插件自己的参数属于第 0 个。
 	*/
-	//如果 index 小于 NPARAMS（参数总数），则调用基类的 setParameter 方法设置参数。
-	if (index < NPARAMS)
-		Base::setParameter (index, newValue, sampleOffset);
-	else if (index == BaseController::kPresetParam) // program change
+	int32 part;
+	ParamID id;
+	if (mapControl (index, part, id))
+		queueControl (part, id, newValue, sampleOffset);
+}
+
+//-----------------------------------------------------------------------------
+tresult PLUGIN_API PianoProcessor::process (ProcessData& data)
+{
+	/*BaseProcessor::process 只把每个队列的最后一个点交给 setParameter，块内的自动化斜坡和重新踩下的踏板会合并成一次变化。
+	这里自己把每个队列的每个点都排进 controlChanges，再把 inputParameterChanges 置空交给 Base::process 处理事件和渲染。*/
+	IParameterChanges* changes = data.inputParameterChanges;
+	if (changes)
+		queueParameterChanges (changes);	//只是排队，applyControl 到了采样点才 recalculatePart
+	data.inputParameterChanges = nullptr;
+	tresult result = Base::process (data);
+	data.inputParameterChanges = changes;
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::queueParameterChanges (IParameterChanges* changes)
+{
+	/*每个队列自己按 sampleOffset 排好，但队列之间交错：逐点插入排序时几条逐采样的斜坡要挪动 O(点数²) 次。
+	放得下时先全部追加到末尾，再按 (sampleOffset, 到达顺序) 排一次，结果和逐点插入相同；放不下时逐点走 queueControl 的溢出处理。*/
+	int32 count = changes->getParameterCount ();
+	int32 total = 0;
+	for (int32 i = 0; i < count; i++)
 	{
-		/*
-		如果 index 是预设参数（kPresetParam），则根据 newValue 计算新的程序（预设）索引，并将 currentProgram 设置为该索引。
-		从 programParams 数组中获取新预设参数，并更新 params 数组中的所有参数值。
-		newValue * kNumPrograms = 0.75 * 10 = 7.5
-		(int32)(newValue * kNumPrograms) = (int32)7.5 = 7
-		std::min<int32>(9, 7) = 7
-		在这种情况下，currentProgram 将被设置为 7。
+		if (IParamValueQueue* queue = changes->getParameterData (i))
+			total += queue->getPointCount ();
+	}
+	bool append = total <= (int32)controlChanges.size () - numControlChanges;
+	bool sorted = true;
 
-		*/
-		currentProgram = std::min<int32> (kNumPrograms - 1, (int32)(newValue * kNumPrograms));
-		const float* newParams = programParams[currentProgram];
-		if (newParams)
+	for (int32 i = 0; i < count; i++)
+	{
+		IParamValueQueue* queue = changes->getParameterData (i);
+		if (!queue)
+			continue;
+		ParamID index = queue->getParameterId ();
+		int32 points = queue->getPointCount ();
+		int32 part;
+		ParamID id;
+		if (!mapControl (index, part, id))
+			continue;
+		for (int32 j = 0; j < points; j++)
 		{
-			for (int32 i = 0; i < NPARAMS; i++)
-				params[i] = newParams[i];
+			int32 sampleOffset;
+			ParamValue value;
+			if (queue->getPoint (j, sampleOffset, value) != kResultTrue)
+				continue;
+			if (!append)
+			{
+				queueControl (part, id, value, sampleOffset);
+				continue;
+			}
+			if (id == BaseController::kSustainParam)
+				parts[part].sustainValue = value;
+			else if (id == BaseController::kModWheelParam)
+				parts[part].modWheelValue = value;
+			if (numControlChanges > 0 && controlChanges[numControlChanges - 1].sampleOffset > sampleOffset)
+				sorted = false;
+			ControlChange& c = controlChanges[numControlChanges++];
+			c.sampleOffset = sampleOffset;
+			c.part = part;
+			c.id = id;
+			c.value = value;
 		}
 	}
-	else if (index == BaseController::kModWheelParam) // mod wheel
+
+	if (!sorted)
 	{
-		/*
-		如果 index 是调制轮参数（kModWheelParam），则将 newValue 乘以 127。计算 muff 参数，用于调整滤波器或其他音频效果。
-		*/
-		newValue *= 127.;
-		muff = 0.01f * (float)((127 - newValue) * (127 - newValue));
+		for (int32 i = 0; i < numControlChanges; i++)
+			controlChanges[i].order = i;
+		std::sort (controlChanges.begin (), controlChanges.begin () + numControlChanges,
+			[] (const ControlChange& a, const ControlChange& b) {
+				return a.sampleOffset != b.sampleOffset ? a.sampleOffset < b.sampleOffset : a.order < b.order;
+			});
 	}
-	else if (index == BaseController::kSustainParam)
+}
+
+//-----------------------------------------------------------------------------
+bool PianoProcessor::mapControl (ParamID index, int32& part, ParamID& id) const
+{
+	//参数 ID 换算成声部组合和 controlChanges 里的四类变化；不认识的 ID 返回 false
+	part = 0;
+	id = index;
+	if (index < NPARAMS || index == BaseController::kPresetParam
+	    || index == BaseController::kModWheelParam || index == BaseController::kSustainParam)
+		return true;
+	if (index < kPartParamBase || index >= (ParamID)partParamID (kNumParts, 0))
+		return false;
+	part = (int32)(index - kPartParamBase) / kPartParamStride;
+	int32 i = (int32)(index - kPartParamBase) % kPartParamStride;
+	if (i < NPARAMS)
+		id = i;
+	else if (i == kPartProgram)
+		id = BaseController::kPresetParam;
+	else if (i == kPartModWheel)
+		id = BaseController::kModWheelParam;
+	else if (i == kPartSustain)
+		id = BaseController::kSustainParam;
+	else
+		return false;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::queueControl (int32 part, ParamID id, ParamValue value, int32 sampleOffset)
+{
+	if (id == BaseController::kSustainParam)
+		parts[part].sustainValue = value;
+	else if (id == BaseController::kModWheelParam)
+		parts[part].modWheelValue = value;
+
+	/*队列满了：最早的一个变化马上生效（相当于挪到块首），不覆盖也不丢掉任何变化（丢掉别的声部组合的抬踏板会让音挂住），
+	并计数。新的比队列里的都早时就是它自己马上生效。*/
+	if (numControlChanges == (int32)controlChanges.size ())
 	{
-		/*
-		如果 index 是延音踏板参数（kSustainParam），则将 synthData.sustain 设置为 newValue 是否大于 0.5。
-		如果 synthData.sustain 设置为 0，则遍历所有声部（voices），找到那些延音音符（SustainNoteID），并更新其衰减值 v.dec。
-		*/
-		synthData.sustain = newValue > 0.5;
-		if (synthData.sustain==0)
+		controlOverflows.fetch_add (1, std::memory_order_relaxed);
+		if (sampleOffset < controlChanges[0].sampleOffset)
+		{
+			ControlChange change = {sampleOffset, part, id, 0, value};
+			applyEarlyControl (change);
+			return;
+		}
+		ControlChange first = controlChanges[0];
+		memmove (controlChanges.data (), controlChanges.data () + 1, --numControlChanges * sizeof (ControlChange));
+		applyEarlyControl (first);
+	}
+
+	//按 sampleOffset 插入排序；同一采样点上先到的先生效
+	int32 i = numControlChanges++;
+	while (i > 0 && controlChanges[i - 1].sampleOffset > sampleOffset)
+	{
+		controlChanges[i] = controlChanges[i - 1];
+		i--;
+	}
+	controlChanges[i].sampleOffset = sampleOffset;
+	controlChanges[i].part = part;
+	controlChanges[i].id = id;
+	controlChanges[i].value = value;
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::applyEarlyControl (const ControlChange& change)
+{
+	//记录时单独记下，重放时在这一块排队的变化之前按同样的顺序生效；放不下的计数，这一块之后的重放不再逐位相同
+	applyControl (change.part, change.id, change.value);
+	if (!tracing)
+		return;
+	if (numEarlyControls < (int32)earlyControls.size ())
+		earlyControls[numEarlyControls++] = change;
+	else
+		lostEarlyControls++;
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::drainLiveEvents (int32 sampleFrames)
+{
+	/*独立渲染模式：取出 liveEvents 里在本块之内到期的事件，时间换算成 sampleOffset（四舍五入到采样）。
+	音符插进 synthData.events，和宿主的事件按 sampleOffset 合并（同一采样点宿主的在前），其余的进 controlChanges。
+	时间已经过去的放在 0 并计数；比前一个事件早的当作和前一个同时，保持放入的顺序。
+	之后的块才到期的事件，以及事件数组或参数队列满了时剩下的，留在队列里等后面的块。
+	和上次排进来的值相同的踏板、调制轮事件直接丢掉；同一采样点同一个参数的多次变化只保留最后一个。*/
+	double blockStart = (double)liveFrames.load (std::memory_order_relaxed);
+	int32 numEvents = 0;
+	while (synthData.events[numEvents].sampleOffset != 0x7FFFFFFF)
+		numEvents++;
+	int32 last = 0;
+	while (const LiveEvent* e = liveEvents.peek ())
+	{
+		double t = floor (e->time * Fs - blockStart + 0.5);
+		if (t >= sampleFrames)
+			break;
+		int32 offset = t > last ? (int32)t : last;
+		if (e->type == LiveEvent::kControl)
 		{
-			for (auto& v : synthData.voice)
+			int32 part;
+			ParamID id;
+			if (mapControl (e->id, part, id))
 			{
-				if (v.noteID = SustainNoteID)
+				const Part& P = parts[part];
+				const ControlChange* prev = numControlChanges > 0 ? &controlChanges[numControlChanges - 1] : nullptr;
+				if ((id == BaseController::kSustainParam && e->value == P.sustainValue)
+				    || (id == BaseController::kModWheelParam && e->value == P.modWheelValue))
+					liveEvents.addCoalesced ();
+				else
 				{
-					/*
-					如果当前音符处于延音状态，代码会计算并设置衰减参数 dec。具体计算公式如下：iFs 是采样时间间隔，即采样率的倒数。
-					(double)v.note 将音符值转换为双精度浮点数。params[1] 是一个外部参数，影响衰减时间。
-					计算公式包含两个 exp 函数（指数函数），用于计算复合衰减率。
-					*/
-					v.dec = (float)exp (-iFs * exp (6.0 + 0.01 * (double)v.note - 5.0 * params[1]));
+					if (prev && prev->sampleOffset == offset && prev->part == part && prev->id == id)
+					{
+						numControlChanges--;	//排在最后，去掉后重新排进来还在同一个位置
+						liveEvents.addCoalesced ();
+					}
+					else if (numControlChanges == (int32)controlChanges.size ())
+						break;
+					queueControl (part, id, e->value, offset);
 				}
 			}
 		}
+		else
+		{
+			if (numEvents >= (int32)synthData.events.size () - 1)
+				break;
+			Event event = {};
+			event.sampleOffset = offset;
+			event.flags = Event::kIsLive;
+			if (e->type == LiveEvent::kNoteOn)
+			{
+				event.type = Event::kNoteOnEvent;
+				event.noteOn.channel = (int16)e->channel;
+				event.noteOn.pitch = (int16)e->pitch;
+				event.noteOn.velocity = e->velocity;
+				event.noteOn.noteId = e->noteId;
+			}
+			else
+			{
+				event.type = Event::kNoteOffEvent;
+				event.noteOff.channel = (int16)e->channel;
+				event.noteOff.pitch = (int16)e->pitch;
+				event.noteOff.noteId = e->noteId;
+			}
+			int32 i = numEvents++;
+			synthData.events[i + 1].sampleOffset = 0x7FFFFFFF;
+			while (i > 0 && synthData.events[i - 1].sampleOffset > offset)
+			{
+				synthData.events[i] = synthData.events[i - 1];
+				i--;
+			}
+			synthData.events[i] = event;
+		}
+		if (t < 0.0 && e->time > 0.0)
+			liveEvents.addLate ();
+		last = offset;
+		liveEvents.pop ();
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::applyControl (int32 part, ParamID id, ParamValue value)
+{
+	Part& P = parts[part];
+	if (id < NPARAMS)
+	{
+		if (P.params == params)
+			Base::setParameter (id, value, 0);	//part 0: the plugin's own parameters
+		else
+			P.params[id] = value;
+		recalculatePart (P);	//只重算这个参数影响到的值和表
+	}
+	else if (id == BaseController::kPresetParam) // program change
+	{
+		/*
+		根据 value 计算新的程序（预设）索引，并将 P.program 设置为该索引。
+		value * kNumPrograms = 0.75 * 8 = 6
+		std::min<int32>(7, 6) = 6
+		*/
+		selectProgram (P, std::min<int32> (kNumPrograms - 1, (int32)(value * kNumPrograms)));
+	}
+	else if (id == BaseController::kModWheelParam) // mod wheel
+	{
+		//调制轮：value * 127 换算成 muff，闷音量 muffle 在之后的子块里平滑过去，正在响的音也跟着变
+		value *= 127.;
+		P.muff = 0.01f * (float)((127 - value) * (127 - value));
+		P.muffleTarget = P.params[4] * P.params[4] * P.muff;
+	}
+	else if (id == BaseController::kSustainParam)
+		sustainEvent (P, (float)value);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::selectProgram (Part& P, uint32 program)
+{
+	/*换程序：参数从 programParams 抄过来，派生值和表直接换成 buildPrograms () 预先生成的快照（一次指针赋值），
+	音频线程上不重建任何表。cdep 和 muffle 的目标跟着变，由 smoothPart 在 SMOOTH_TIME 内平滑过去，
+	立体声模拟器不会跳变；正在响的声部保留按下时的系数，新的音符用新程序。*/
+	P.program = program;
+	const float* newParams = programParams[program];
+	for (int32 i = 0; i < NPARAMS; i++)
+		P.params[i] = newParams[i];
+	recalculatePart (P);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::flushControls ()
+{
+	//不在处理中（停用、全部静音）时把排队的变化一次生效；踏板不再有意义，丢掉
+	for (int32 i = 0; i < numControlChanges; i++)
+	{
+		if (controlChanges[i].id != BaseController::kSustainParam)
+			applyControl (controlChanges[i].part, controlChanges[i].id, controlChanges[i].value);
+	}
+	numControlChanges = 0;
+}
+
+//-----------------------------------------------------------------------------
+static double smoothTowards (double x, double target, double a)
+{
+	//一阶平滑走一步；离目标足够近就直接到位，之后 smoothControls 不再做任何事
+	double y = x + a * (target - x);
+	return fabs (target - y) <= 1.0e-6 * (fabs (target) + 1.0) ? target : y;
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::smoothControls (int32 frames)
+{
+	/*立体声深度 cdep 和闷音量 muffle（Muffling 参数 x 调制轮）每个子块向目标值走一步（一阶平滑，时间常数 SMOOTH_TIME），
+	不逐采样重算。每个声部组合各自平滑。*/
+	for (int32 p = 0; p < kNumParts; p++)
+		smoothPart (p, frames);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::smoothPart (int32 part, int32 frames)
+{
+	//muffle 变了就重算这个声部组合正在响的声部的滤波系数，SoA（lanes）和 AoS 两份一起改
+	Part& P = parts[part];
+	float cdepTarget = P.snapshot->cdep;
+	if (P.cdep == cdepTarget && P.muffle == P.muffleTarget)
+		return;
+	double a = 1.0 - exp (-frames * (double)iFs / SMOOTH_TIME);
+	P.cdep = (float)smoothTowards (P.cdep, cdepTarget, a);
+	if (P.muffle != P.muffleTarget)
+	{
+		P.muffle = smoothTowards (P.muffle, P.muffleTarget, a);
+		for (int32 v = 0; v < synthData.activevoices; v++)
+		{
+			VOICE& V = synthData.voice[v];
+			if (V.part != part)
+				continue;
+			V.ff = voiceCutoff (P, V.note, V.fvel);
+			lanes[v / kVoiceLanes].ff[v % kVoiceLanes] = V.ff;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::snapControls ()
+{
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		parts[p].cdep = parts[p].snapshot->cdep;
+		parts[p].muffle = parts[p].muffleTarget;
 	}
 }
 
 //-----------------------------------------------------------------------------
 void PianoProcessor::setCurrentProgram (Steinberg::uint32 val)
 {
-	currentProgram = val;
+	parts[0].program = val;
 }
 
 //-----------------------------------------------------------------------------
@@ -335,8 +818,70 @@ void PianoProcessor::setCurrentProgramNormalized (ParamValue val)
 	setCurrentProgram (std::min<int32> (kNumPrograms - 1, (int32)(val * kNumPrograms)));
 }
 
+//-----------------------------------------------------------------------------
+tresult PLUGIN_API PianoProcessor::canProcessSampleSize (int32 symbolicSampleSize)
+{
+	//32 位和 64 位输出都直接支持，64 位宿主不用每块转换缓冲
+	return (symbolicSampleSize == kSample32 || symbolicSampleSize == kSample64) ? kResultTrue : kResultFalse;
+}
+
 //-----------------------------------------------------------------------------
 void PianoProcessor::doProcessing (ProcessData& data)
+{
+	/*按宿主的采样精度选择 renderBlock 的实例，每块只判断一次，渲染循环里没有分支。
+	声部、混音缓冲和延迟线始终是 float（采样是 16 位整数，float 的精度已经足够），
+	64 位路径从立体声模拟器的最后一次混合开始用 double，直接写进宿主的 64 位缓冲。*/
+	if (data.symbolicSampleSize == kSample64)
+		renderBlock<Sample64> (data);
+	else
+		renderBlock<Sample32> (data);
+}
+
+//-----------------------------------------------------------------------------
+static Sample32** channelBuffers (AudioBusBuffers& bus, Sample32*) { return bus.channelBuffers32; }
+static Sample64** channelBuffers (AudioBusBuffers& bus, Sample64*) { return bus.channelBuffers64; }
+
+//-----------------------------------------------------------------------------
+template <typename SampleType>
+void PianoProcessor::routeParts (ProcessData& data, PartOutputs<SampleType>& outputs)
+{
+	//声部组合 p 写第 p 条输出总线；宿主没有给这条总线（没有激活或不到两个声道）时加到主输出上
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		SampleType** buffers = nullptr;
+		if (p < data.numOutputs && data.outputs[p].numChannels >= 2)
+			buffers = channelBuffers (data.outputs[p], (SampleType*)nullptr);
+		outputs.mix[p] = p > 0 && !buffers;
+		if (outputs.mix[p])
+			buffers = channelBuffers (data.outputs[0], (SampleType*)nullptr);
+		outputs.out0[p] = buffers[0];
+		outputs.out1[p] = buffers[1];
+		data.outputs[outputs.mix[p] ? 0 : p].silenceFlags = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+template <typename SampleType>
+void PianoProcessor::renderParts (PartOutputs<SampleType>& outputs, int32 offset, int32 frames)
+{
+	/*每个声部组合各自跑立体声模拟器。没有声部、延迟线也放完了的组合不计算：
+	有自己总线的写 0，加到主输出上的跳过（主输出已经由第 0 个组合写好）。*/
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		Part& P = parts[p];
+		if (P.voices > 0 || P.stereoTail > 0)
+			renderStereo (P, outputs.out0[p] + offset, outputs.out1[p] + offset, frames, outputs.mix[p]);
+		else if (!outputs.mix[p])
+		{
+			memset (outputs.out0[p] + offset, 0, frames * sizeof (SampleType));
+			memset (outputs.out1[p] + offset, 0, frames * sizeof (SampleType));
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+template <typename SampleType>
+void PianoProcessor::renderBlock (ProcessData& data)
 {
 	/*这个函数负责处理音频数据，是音频合成器的核心处理循环。它处理合成器的所有音频处理任务，包括音符的生成和混合。让我们逐行解析这个函数的作用。
 	获取处理的数据帧数 sampleFrames。
@@ -344,112 +889,634 @@ void PianoProcessor::doProcessing (ProcessData& data)
 	初始化一些局部变量，用于音频处理循环。
 	*/
 	int32 sampleFrames = data.numSamples;
+
+	//整个处理过程打开 FTZ/DAZ，衰减到次正规数的包络、滤波器和延迟线 直接当 0 算，避免长延音尾巴上的 CPU 尖峰
+#if MDA_PIANO_DENORMAL_GUARD
+	ScopedNoDenormals noDenormals;
+#endif
+	//离线处理（导出、BKmdaPianoRender）没有实时时限，按耗时减声部只会让输出随机器负载变化；重放 trace 时仍按录下的上限
+	bool budget = voiceBudget.isEnabled () && (processSetup.processMode != kOffline || replayVoiceCap >= 0);
+	bool timing = telemetry.isEnabled ();
+	bool trace = tracing && traceRecorder.isEnabled ();
+	uint64 start = (budget || timing || trace) ? telemetryNow () : 0, t0, t1, t2;
+	
+	if (compressedBank)
+		frameCache.setTiming (timing);
 	
-	float* out0 = data.outputs[0].channelBuffers32[0];
-	float* out1 = data.outputs[0].channelBuffers32[1];
+	PartOutputs<SampleType> outputs;
+	routeParts (data, outputs);
+	drainLiveEvents (sampleFrames);
+	int32 blockControls = numControlChanges;
 
-	int32 frame=0, frames, v;
-	float x, l, r;
-	int32 i;
+	int32 frame=0, frames, n, pos=0;
 
 	synthData.eventPos = 0;
+	blockCount++;
+	blockStats = BlockStats ();
+	blockStats.block = blockCount;
+	blockStats.frames = sampleFrames;
+	blockStats.maxActiveVoices = synthData.activevoices;
 	/*
-	主循环中，遍历每个样本帧。内部循环处理每个活跃的声部（voice），计算每个声部的音频数据，并将其混合到左右声道。调用 noteEvent 处理 MIDI 事件，更新声部状态。
+	主循环按事件切分子块：两个事件的 sampleOffset 之间的所有帧作为一个子块处理。
+	每个子块内先按声部渲染（renderVoices，一个声部连续算完整段，状态留在寄存器里），再对整段跑立体声模拟器（renderStereo）。
+	声部在每一帧的累加顺序与原来的逐帧循环相同（v=0,1,2...），所以输出与逐帧版本逐位一致，事件仍然在原来的采样点生效。
 	样本帧（Sample Frame）样本帧是指一组采样点。在单声道音频中，每个样本帧包含一个样本；而在立体声音频中，每个样本帧包含两个样本，一个用于左声道（left channel），一个用于右声道（right channel）。
 	在立体声音频中，如果有 44100 个样本帧，那么实际上有 88200 个样本，因为每个样本帧包含左右两个声道的样本。
 
 	*/
+	int32 controlPos = 0;
 	if (synthData.activevoices > 0 || synthData.hasEvents ())
 	{    
-		//如果有活跃的声部或待处理的事件，则进入处理逻辑。
+		//如果有活跃的声部或待处理的音符事件，则进入处理逻辑；只有参数变化时它们在块尾生效，整块走 renderIdle。
 		while (frame<sampleFrames)
 		{/*frame 是当前处理的样本帧索引。sampleFrames 是总的样本帧数。循环遍历每个样本帧。*/
 
-			/*获取当前事件的样本偏移量 sampleOffset。确保 frames 不超过总样本帧数 sampleFrames。更新当前样本帧索引。*/
+			/*获取下一个事件的样本偏移量 sampleOffset：音符事件和参数变化中靠前的一个，同一采样点上参数先生效。
+			确保 frames 不超过总样本帧数 sampleFrames。更新当前样本帧索引。*/
 			frames = synthData.events[synthData.eventPos].sampleOffset;
+			bool controlNext = controlPos < numControlChanges && controlChanges[controlPos].sampleOffset <= frames;
+			if (controlNext) frames = controlChanges[controlPos].sampleOffset;
 			if (frames>sampleFrames) frames = sampleFrames;
 			frames -= frame;
 			frame += frames;
 
-			while (--frames>=0)
-			{/*处理当前样本帧的循环。*/
-
-				//初始化左右声道的音频信号：
-				VOICE *V = synthData.voice.data ();
-				l = r = 0.0f;
-
-				for(v=0; v<synthData.activevoices; v++)
-				{/*遍历每个活跃的声部。*/
-					// 处理每个活跃的声部（voice）计算音频信号，并累积到左声道和右声道
-					//integer-based linear interpolation
-					//线性插值：解决分辨率问题：由于波形数据是以离散样本存储的，当需要在不同频率上播放音符时，可能会出现样本点之间的跳跃。
-					//线性插值通过计算样本点之间的中间值，平滑过渡。避免音频失真：如果不进行插值，音频信号会显得生硬或“步进化”，从而引起失真。
-					//通过线性插值，合成器能够平滑地播放音符，而不会在样本点之间产生突然的变化。
-					//下面的waves就是PCM音频数据
-					V->frac += V->delta;  // 增加小数部分 
-					V->pos += V->frac >> 16;// 更新位置
-					V->frac &= 0xFFFF;// 保留小数部分
-					if (V->pos > V->end) V->pos -= V->loop;// 循环处理
-					//i = (i << 7) + (V->frac >> 9) * (waves[V->pos + 1] - i) + 0x40400000;   //not working on intel mac !?!
-					i = waves[V->pos] + ((V->frac * (waves[V->pos + 1] - waves[V->pos])) >> 16);// 线性插值
-					x = V->env * (float)i / 32768.0f;
-					//x = V->env * (*(float *)&i - 3.0f);  //fast int->float
-
-					//包络和滤波：控制音符的动态变化：包络用于控制音符的音量随时间的变化，从而模拟真实乐器的演奏特性。
-					//例如，钢琴音符通常有一个快速的音量上升（攻击），然后逐渐减弱（衰减和释放）。
-					//改变音色：滤波器用于改变音频信号的频谱特性，模仿不同的音色。
-					//例如，可以通过滤波器来模拟钢琴的音色特征，使得声音更加真实和具有表现力。
-					//通过包络和滤波，可以控制音符的动态变化和音色，使得合成器生成的声音更加自然和富有表现力。
-					V->env = V->env * V->dec;  //envelope
-					V->f0 += V->ff * (x + V->f1 - V->f0);  //muffle filter
-					V->f1 = x;
-
-
-					//累加左右声道的音频信号：生成立体声音效：在立体声系统中，左右声道的音频信号需要分别计算和输出，以创造空间感和方向感。
-					//例如，某些音符可能在左声道上音量更大，而在右声道上音量较小，从而模拟声音来源的方向。
-					//混合多个声部：同时播放多个音符时，需要将每个声部的音频信号累加，以生成最终的输出音频信号。
-					//通过累加各个声部的音频信号，合成器能够生成复杂的音频输出，同时处理多个音符并生成立体声音效。
-					l += V->outl * V->f0;
-					r += V->outr * V->f0;
-
-					//防止异常值：
-					if (!(l > -2.0f) || !(l < 2.0f))
-					{
-						printf ("what is this?   %d,  %f,  %f\n", i, x, V->f0);
-						l = 0.0f;
-					}  
-					if (!(r > -2.0f) || !(r < 2.0f))
+			if (frames > 0)
+			{/*子块再按 kBlockSize 切开，累加缓冲 blockL/blockR 始终留在 L1 缓存里。
+			 子块开始时把活跃声部拷贝成 SoA（lanes），结束时写回 synthData.voice，两个事件之间 noteEvent 只看到 AoS 的 VOICE。*/
+				packVoices ();
+				while (frames > 0)
+				{
+					n = (frames < renderLimit) ? frames : renderLimit;
+					smoothControls (n);
+					t0 = timing ? telemetryNow () : 0;
+					renderVoices (n);
+					t1 = timing ? telemetryNow () : 0;
+					renderParts (outputs, pos, n);
+					if (timing)
 					{
-						r = 0.0f;
-					}  
-
-					V++;
+						t2 = telemetryNow ();
+						blockStats.voiceNs += (uint32)(t1 - t0);
+						blockStats.stereoNs += (uint32)(t2 - t1);
+					}
+					pos += n;
+					frames -= n;
+					silentIn -= n;
+					if (silentIn <= 0 && frames > 0)
+					{/*按包络估算有声部已经衰减到 SILENCE 以下：在子块边界上就退休，不再渲染到整块结束*/
+						unpackVoices ();
+						retireVoices ();
+						packVoices ();
+					}
 				}
-				//立体声模拟器：
-				comb[cpos] = l + r;
-				++cpos &= cmax;
-				x = cdep * comb[cpos];  //stereo simulator
-
-				*out0++ = l + x;// 输出到左声道
-				*out1++ = r - x;// 输出到右声道
+				unpackVoices ();
+				//事件之前先退休已经静音的声部，后面的 noteEvent 可以直接用空出来的槽位，不必抢占
+				retireVoices ();
 			}
 
 			if (frame<sampleFrames)
 			{/*处理事件：*/
-				noteEvent (synthData.events[synthData.eventPos]);
-				++synthData.eventPos;
+				t0 = timing ? telemetryNow () : 0;
+				if (controlNext)
+				{
+					const ControlChange& c = controlChanges[controlPos];
+					applyControl (c.part, c.id, c.value);
+					controlPos++;
+				}
+				else
+				{
+					noteEvent (synthData.events[synthData.eventPos]);
+					++synthData.eventPos;
+				}
+				if (timing) blockStats.eventNs += (uint32)(telemetryNow () - t0);
+				blockStats.events++;
+				blockStats.maxActiveVoices = std::max (blockStats.maxActiveVoices, synthData.activevoices);
+			}
+		}
+	}
+	else
+		renderIdle (data, outputs, sampleFrames);
+	//偏移量超出本块的参数变化在块尾生效
+	for (; controlPos < numControlChanges; controlPos++)
+	{
+		const ControlChange& c = controlChanges[controlPos];
+		applyControl (c.part, c.id, c.value);
+		blockStats.events++;
+	}
+	numControlChanges = 0;
+	//原来在整块结束后才在这里检查 env < SILENCE 并移除声部，现在在每个子块和事件之前就做（retireVoices）
+
+	//自适应复音：本块耗时和时限（帧数 / 采样率）比较，超时就降低上限并淡出多余的声部
+	//重放 trace 时用录下来的上限，不按这次的耗时算
+	int32 voiceCap = -1;
+	if (budget)
+	{
+		double seconds = (double)(telemetryNow () - start) * 1.0e-9;
+		if (replayVoiceCap >= 0)
+			voiceCap = voiceBudget.force (replayVoiceCap);
+		else
+			voiceCap = voiceBudget.update (seconds, sampleFrames * (double)iFs, synthData.activevoices);
+		shedVoices (voiceCap);
+	}
+
+	//性能统计：整块写进环形缓冲，读取线程自己去取，这里不等待
+	if (timing)
+	{
+		blockStats.renderNs = (uint32)(telemetryNow () - start);
+		telemetry.publish (blockStats);
+	}
+	if (trace)
+		traceBlock (data, outputs.mix, blockControls, voiceCap, (uint32)(telemetryNow () - start));
+	numEarlyControls = lostEarlyControls = 0;
+	liveFrames.store (liveFrames.load (std::memory_order_relaxed) + sampleFrames, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::traceStart ()
+{
+	TraceStart start = {};
+	start.magic = kTraceMagic;
+	start.version = kTraceVersion;
+	start.sampleRate = getSampleRate ();
+	start.maxSamplesPerBlock = processSetup.maxSamplesPerBlock;
+	start.symbolicSampleSize = processSetup.symbolicSampleSize;
+	getTraceIdentity (start);
+	start.renderThreads = renderThreads;
+	start.compressedSamples = compressedSamples ? 1 : 0;
+	start.numControls = numControlChanges;
+	uint32 size = sizeof (TraceRecord) + sizeof (start) + kNumParts * sizeof (TracePart) + numControlChanges * sizeof (TraceControl);
+	if (!traceRecorder.begin (TraceRecord::kStart, size))
+		return;
+	traceRecorder.put (&start, sizeof (start));
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		TracePart part = {};
+		part.program = parts[p].program;
+		for (int32 i = 0; i < NPARAMS; i++)
+			part.params[i] = parts[p].params[i];
+		traceRecorder.put (&part, sizeof (part));
+	}
+	for (int32 i = 0; i < numControlChanges; i++)
+	{
+		const ControlChange& c = controlChanges[i];
+		TraceControl control = {c.sampleOffset, c.part, c.id, 0, c.value};
+		traceRecorder.put (&control, sizeof (control));
+	}
+	traceRecorder.commit ();
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::getTraceIdentity (TraceStart& start) const
+{
+	start.numParts = kNumParts;
+	start.numVoices = kNumVoices;
+	start.numMipLevels = numMipLevels;
+	start.bankSamples = bank ? bank->getNumSamples () : 0;
+	start.bankSampleRate = bank ? bank->getSampleRate () : 0;
+	start.bankChecksum = bank ? bank->getChecksum () : 0;
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::traceBlock (const ProcessData& data, const bool* mix, int32 numControls, int32 voiceCap, uint32 renderNs)
+{
+	//块尾记录：synthData.events 和 controlChanges 里的内容还在，就是这一块实际处理的（live 事件已经合并进来）
+	TraceBlock block = {};
+	block.block = blockCount;
+	block.frames = data.numSamples;
+	block.symbolicSampleSize = data.symbolicSampleSize;
+	block.numOutputs = data.numOutputs;
+	for (int32 p = 0; p < kNumParts; p++)
+		if (!mix[p]) block.busMask |= 1u << p;
+	block.voiceCap = voiceCap;
+	block.renderNs = renderNs;
+	while (synthData.events[block.numEvents].sampleOffset != 0x7FFFFFFF)
+		block.numEvents++;
+	block.numControls = numControls;
+	block.numEarlyControls = numEarlyControls;
+	block.lostControls = lostEarlyControls;
+	uint32 size = sizeof (TraceRecord) + sizeof (block) + block.numEvents * sizeof (TraceNote)
+		+ (numEarlyControls + numControls) * sizeof (TraceControl);
+	if (!traceRecorder.begin (TraceRecord::kBlock, size))
+		return;
+	traceRecorder.put (&block, sizeof (block));
+	for (int32 i = 0; i < block.numEvents; i++)
+	{
+		const Event& e = synthData.events[i];
+		TraceNote note = {};
+		note.sampleOffset = e.sampleOffset;
+		note.type = e.type;
+		if (e.type == Event::kNoteOnEvent)
+		{
+			note.channel = e.noteOn.channel;
+			note.pitch = e.noteOn.pitch;
+			note.velocity = e.noteOn.velocity;
+			note.noteId = e.noteOn.noteId;
+		}
+		else
+		{
+			note.channel = e.noteOff.channel;
+			note.pitch = e.noteOff.pitch;
+			note.velocity = e.noteOff.velocity;
+			note.noteId = e.noteOff.noteId;
+		}
+		traceRecorder.put (&note, sizeof (note));
+	}
+	for (int32 i = 0; i < numEarlyControls; i++)
+	{
+		const ControlChange& c = earlyControls[i];
+		TraceControl control = {c.sampleOffset, c.part, c.id, 0, c.value};
+		traceRecorder.put (&control, sizeof (control));
+	}
+	for (int32 i = 0; i < numControls; i++)
+	{
+		const ControlChange& c = controlChanges[i];
+		TraceControl control = {c.sampleOffset, c.part, c.id, 0, c.value};
+		traceRecorder.put (&control, sizeof (control));
+	}
+	traceRecorder.commit ();
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::setPartState (int32 part, uint32 program, const ParamValue* values)
+{
+	//part 0 的 params 就是插件自己的参数；派生值和表在 setActive 时重算
+	Part& P = parts[part];
+	P.program = program;
+	for (int32 i = 0; i < NPARAMS; i++)
+		P.params[i] = values[i];
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::shedVoices (int32 cap)
+{
+	/*没有在淡出的声部超过上限时，挑出多余的声部在 SHED_TIME 内淡出到 SILENCE 以下，之后由 retireVoices 移除。
+	优先已经松开的声部（dec 不再等于按住时的 hdec），同类里挑 env 最小的。
+	淡出的声部离开 noteIds 和 sustained，之后的 note-off 和踏板不会再改写它的衰减。*/
+	int32 v, count = 0, shed = 0;
+	for (v = shedding.next (0); v != -1; v = shedding.next (v + 1))
+		count++;
+
+	for (int32 excess = synthData.activevoices - count - cap; excess > 0; excess--)
+	{
+		int32 best = -1;
+		bool bestReleased = false;
+		for (v = 0; v < synthData.activevoices; v++)
+		{
+			if (shedding.test (v))
+				continue;
+			const VOICE& V = synthData.voice[v];
+			bool released = V.dec != V.hdec;
+			if (best < 0 || (released && !bestReleased)
+			    || (released == bestReleased && V.env < synthData.voice[best].env))
+			{
+				best = v;
+				bestReleased = released;
 			}
 		}
+		if (best < 0)
+			break;
+
+		VOICE& V = synthData.voice[best];
+		if (V.env > SILENCE)
+			V.dec = (float)pow (0.5 * SILENCE / V.env, 1.0 / (Fs * SHED_TIME));
+		noteIds.erase (best);
+		sustained.reset (best);
+		shedding.set (best);
+		shed++;
+	}
+	if (shed > 0)
+		voiceBudget.addShedVoices (shed);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::retireVoices ()
+{
+	/*检查每个活跃声部的包络值（env）是否小于 SILENCE（#define SILENCE 0.0001f），小于则移除。
+	removeVoice 把最后一个活跃声部搬到 v，槽位立即空出来给后面的音符用；搬过来的声部还要再检查一次，所以这时 v 不前进。*/
+	for (int32 v = 0; v < synthData.activevoices;)
+	{
+		if (synthData.voice[v].env < SILENCE)
+			removeVoice (v);
+		else
+			v++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+int32 PianoProcessor::framesUntilSilent (float env, float dec)
+{
+	//env 每帧乘 dec：env * dec^n < SILENCE  =>  n > log (SILENCE / env) / log (dec)
+	if (env < SILENCE)
+		return 0;
+	if (!(dec < 1.0f) || !(dec > 0.0f))
+		return 0x7FFFFFFF;
+	double n = std::log ((double)SILENCE / env) / std::log ((double)dec);
+	return n < 1.0e9 ? (int32)n : 0x7FFFFFFF;	//向下取整：宁早勿晚，早了只是多检查一次
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::removeVoice (int32 v)
+{
+	//压缩：最后一个活跃声部搬到 v，noteIds、quietVoices 和 sustained 跟着改槽位号
+	noteIds.erase (v);
+	quietVoices.erase (v);
+	sustained.reset (v);
+	shedding.reset (v);
+	parts[synthData.voice[v].part].voices--;
+	int32 last = --synthData.activevoices;
+	if (v != last)
+	{
+		synthData.voice[v] = synthData.voice[last];
+		noteIds.move (last, v);
+		quietVoices.move (last, v);
+		if (sustained.test (last))
+		{
+			sustained.reset (last);
+			sustained.set (v);
+		}
+		if (shedding.test (last))
+		{
+			shedding.reset (last);
+			shedding.set (v);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::clearVoiceIndex ()
+{
+	noteIds.clear ();
+	quietVoices.clear ();
+	sustained.clear ();
+	shedding.clear ();
+	numControlChanges = 0;
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		parts[p].voices = 0;
+		parts[p].pedal = 0.0f;
+		parts[p].sustainValue = parts[p].modWheelValue = -1.0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::packVoices ()
+{
+	//AoS -> SoA：第 v 个活跃声部放到 lanes[v / kVoiceLanes] 的第 v % kVoiceLanes 条通道
+	int32 v, k, maxDelta = 1;
+	silentIn = 0x7FFFFFFF;
+	for(v=0; v<synthData.activevoices; v++)
+	{
+		const VOICE& V = synthData.voice[v];
+		silentIn = std::min (silentIn, framesUntilSilent (V.env, V.dec));
+		maxDelta = std::max (maxDelta, V.delta);
+		VoiceLanes& L = lanes[v / kVoiceLanes];
+		k = v % kVoiceLanes;
+		L.delta[k] = V.delta;  L.frac[k] = V.frac;  L.pos[k] = V.pos;  L.end[k] = V.end;  L.loop[k] = V.loop;
+		L.env[k] = V.env;  L.dec[k] = V.dec;
+		L.f0[k] = V.f0;  L.f1[k] = V.f1;  L.ff[k] = V.ff;
+		L.outl[k] = V.outl;  L.outr[k] = V.outr;
+	}
+	//最后一组里没用到的通道填成静音
+	for (; v % kVoiceLanes; v++)
+		lanes[v / kVoiceLanes].clear (v % kVoiceLanes);
+
+	//压缩存储：每次渲染的帧数不超过 stage 能放下的采样数（音高很高的声部一帧前进好几个采样）
+	renderLimit = kBlockSize;
+	if (compressedBank)
+		renderLimit = (int32)std::max<int64> (1, std::min<int64> (kBlockSize, ((int64)(kStageEntries - 2) << 16) / maxDelta));
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::unpackVoices ()
+{
+	//只有播放位置、包络和滤波器状态在渲染中会变
+	//滤波器状态跨块保存，写回时把接近 0 的值清掉，不依赖宿主线程的 FTZ 设置
+	for(int32 v=0; v<synthData.activevoices; v++)
+	{
+		VOICE& V = synthData.voice[v];
+		const VoiceLanes& L = lanes[v / kVoiceLanes];
+		int32 k = v % kVoiceLanes;
+		V.frac = L.frac[k];  V.pos = L.pos[k];
+		V.env = L.env[k];
+		V.f0 = guardDenormal (L.f0[k]);  V.f1 = guardDenormal (L.f1[k]);
+		quietVoices.update (v, V.env);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::renderVoices (int32 frames)
+{
+	/*按声部组渲染 frames 帧到 blockL/blockR。
+	voiceKernel 一次处理一组 kVoiceLanes 个声部（AVX2 一条指令 8 个，SSE2 两次 4 个，或标量回退），
+	积分插值 waves[pos] + ((frac * (waves[pos+1]-waves[pos])) >> 16)、包络 env *= dec 和闷音滤波都在内核里完成。
+	内核把每个声部的输出写到 laneL/laneR，这里再按 v=0,1,2... 的顺序累加，累加循环没有分支，编译器可以直接向量化。
+	*/
+	int32 g, count;
+	int32 groups = (synthData.activevoices + kVoiceLanes - 1) / kVoiceLanes;
+
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		if (parts[p].voices == 0 && parts[p].stereoTail == 0)
+			continue;	//renderParts skips it
+		memset (parts[p].mixL, 0, sizeof (float) * frames);
+		memset (parts[p].mixR, 0, sizeof (float) * frames);
+	}
+
+	if (compressedBank)
+		stageVoices (frames);
+
+	if (groupMix && renderPool && groups >= kMinParallelGroups)
+	{
+		/*并行模式：每个声部组是一个任务，由工作线程或本线程渲染到各自的 groupMix[g]，互不共享内存。
+		全部完成后仍在本线程按 v=0,1,2... 的顺序累加，加法顺序与单线程完全相同，
+		输出与线程数、任务由哪个线程执行都无关，逐位可复现。*/
+		renderFrames = frames;
+		renderPool->run (renderGroupJob, this, groups);
+		for (g=0; g<groups; g++)
+		{
+			count = synthData.activevoices - g * kVoiceLanes;
+			mixLanes (groupMix[g].l, groupMix[g].r, g * kVoiceLanes, count < kVoiceLanes ? count : kVoiceLanes, frames);
+		}
+	}
+	else
+	{
+		for (g=0; g<groups; g++)
+		{
+			voiceKernel (lanes[g], waves, laneL, laneR, frames);
+
+			count = synthData.activevoices - g * kVoiceLanes;
+			mixLanes (laneL, laneR, g * kVoiceLanes, count < kVoiceLanes ? count : kVoiceLanes, frames);
+		}
+	}
+
+	if (compressedBank)
+		unstageVoices ();
+
+	checkVoiceMix (frames);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::stageVoices (int32 frames)
+{
+	/*压缩存储：第 v 个声部这一段会读到 pos .. pos + ((frac + frames * delta) >> 16)，
+	由 frameCache 解码（或直接取已经解码的帧）后按 SampleCache 的格式写到 stage[v * kStageEntries]，越过 end 的部分已经回绕。
+	通道的 pos 临时指向 stage，end 设成不会回绕，内核不用改；渲染完由 unstageVoices 换回音色库里的位置。*/
+	for (int32 v = 0; v < synthData.activevoices; v++)
+	{
+		VoiceLanes& L = lanes[v / kVoiceLanes];
+		int32 k = v % kVoiceLanes;
+		VOICE& V = synthData.voice[v];
+		int32 count = (int32)(((int64)L.frac[k] + (int64)L.delta[k] * frames) >> 16) + 1;
+		frameCache.fill (V.cursor, L.pos[k], V.end, V.loop, count, stage + v * kStageEntries);
+		stagePos[v] = L.pos[k];
+		L.pos[k] = v * kStageEntries;
+		L.end[k] = 0x7FFFFFFF;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::unstageVoices ()
+{
+	for (int32 v = 0; v < synthData.activevoices; v++)
+	{
+		VoiceLanes& L = lanes[v / kVoiceLanes];
+		int32 k = v % kVoiceLanes;
+		L.pos[k] = stagePos[v] + (L.pos[k] - v * kStageEntries);
+		L.end[k] = synthData.voice[v].end;
+		while (L.pos[k] > L.end[k]) L.pos[k] -= L.loop[k];
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::mixLanes (const float* l, const float* r, int32 first, int32 count, int32 frames)
+{
+	for (int32 k=0; k<count; k++)
+	{
+		//累加左右声道的音频信号：混合多个声部：同时播放多个音符时，需要将每个声部的音频信号累加，以生成最终的输出音频信号。
+		//所有声部组合的声部在同一遍里渲染，这里按声部所属的组合分开累加
+		Part& P = parts[synthData.voice[first + k].part];
+		for (int32 f=0; f<frames; f++)
+		{
+			P.mixL[f] += l[f * kVoiceLanes + k];
+			P.mixR[f] += r[f * kVoiceLanes + k];
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+template <typename SampleType>
+void PianoProcessor::renderIdle (ProcessData& data, PartOutputs<SampleType>& outputs, int32 frames)
+{
+	/*没有声部也没有事件：原来整块什么都不写，宿主拿到的是缓冲里原有的内容，延迟线里的尾巴也被截断。
+	现在先把延迟线的尾巴放完（输入为 0，只跑立体声模拟器），之后整块清零并设置 silenceFlags，
+	宿主可以据此跳过下游插件。尾巴放完以后每块只剩两次 memset。
+	加到主输出上的声部组合在第 0 个组合写完整块之后再加它们的尾巴。*/
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		Part& P = parts[p];
+		int32 frame = 0;
+		while (P.stereoTail > 0 && frame < frames)
+		{
+			int32 n = std::min<int32> (std::min (frames - frame, P.stereoTail), kBlockSize);
+			smoothPart (p, n);
+			memset (P.mixL, 0, n * sizeof (float));
+			memset (P.mixR, 0, n * sizeof (float));
+			renderStereo (P, outputs.out0[p] + frame, outputs.out1[p] + frame, n, outputs.mix[p]);
+			frame += n;
+		}
+
+		//延迟线里读得到的部分已经全是 0，之后不必再推进；没有声音了，平滑量直接到位
+		if (P.stereoTail == 0)
+		{
+			P.cdep = P.snapshot->cdep;
+			P.muffle = P.muffleTarget;
+		}
+		int32 bus = outputs.mix[p] ? 0 : p;
+		if (!outputs.mix[p])
+		{
+			memset (outputs.out0[p] + frame, 0, (frames - frame) * sizeof (SampleType));
+			memset (outputs.out1[p] + frame, 0, (frames - frame) * sizeof (SampleType));
+			if (frame == 0)
+				data.outputs[bus].silenceFlags = (1ULL << data.outputs[bus].numChannels) - 1;
+		}
+		else if (frame > 0)
+			data.outputs[bus].silenceFlags = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::renderGroupJob (void* context, int32 group)
+{
+	//在工作线程上执行：只读写 lanes[group] 和 groupMix[group]
+	PianoProcessor* p = static_cast<PianoProcessor*> (context);
+	p->voiceKernel (p->lanes[group], p->waves, p->groupMix[group].l, p->groupMix[group].r, p->renderFrames);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::checkVoiceMix (int32 frames)
+{
+	/*防止异常值：原来在每个声部、每一帧都做 !(l > -2.0f) || !(l < 2.0f) 判断并 printf，
+	现在整段混音完成后做一次向量化扫描，坏值（越界或 NaN）清零，再把现场记录到 faultMonitor。
+	与逐声部检查的区别：原来是把累加到一半的和清零再继续加后面的声部，现在是把这一帧的总和清零；没有坏值时输出完全相同。
+	音频线程不调用 printf，需要看故障的话从其他线程读 getFaultMonitor ()。
+	*/
+	for (int32 p = 0; p < kNumParts; p++)
+	{
+		if (parts[p].voices == 0)
+			continue;
+		BlockScan scan;
+		scanAndClearBlock (parts[p].mixL, parts[p].mixR, frames, 2.0f, scan);
+		if (scan.badSamples)
+		{
+			FaultSnapshot snapshot;
+			snapshot.block = blockCount;
+			snapshot.frame = scan.firstBad;
+			snapshot.activeVoices = synthData.activevoices;
+			snapshot.badSamples = scan.badSamples;
+			snapshot.nanSamples = scan.nanSamples;
+			snapshot.minL = scan.minL;  snapshot.maxL = scan.maxL;
+			snapshot.minR = scan.minR;  snapshot.maxR = scan.maxR;
+			faultMonitor.report (snapshot);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+template <typename SampleType>
+void PianoProcessor::renderStereo (Part& P, SampleType* out0, SampleType* out1, int32 frames, bool mix)
+{
+	//立体声模拟器：声部全部累加完之后，整段 (L+R) 过延迟线，再按 cdep 混回左右声道。
+	//三个循环都没有跨帧依赖，编译器可以直接向量化。每个声部组合有自己的延迟线和 cdep。
+	const float* mixL = P.mixL;
+	const float* mixR = P.mixR;
+	for (int32 f=0; f<frames; f++)
+		blockM[f] = guardDenormal (mixL[f] + mixR[f]);	//声部都衰减完以后延迟线里只剩 0，而不是一串次正规数
+
+	P.stereoDelay.process (blockM, blockD, frames);
+	//有声部时尾巴从头算起，否则继续往下放
+	P.stereoTail = P.voices > 0 ? P.stereoDelay.getTailFrames () : std::max (0, P.stereoTail - frames);
+
+	//最后一次混合按输出精度计算：float 时和原来逐位相同，double 时和不再舍入到 float
+	SampleType cdep = (SampleType)P.cdep;
+	if (mix)
+	{
+		for (int32 f=0; f<frames; f++)
+		{
+			SampleType x = cdep * blockD[f];  //stereo simulator
+
+			out0[f] += mixL[f] + x;
+			out1[f] += mixR[f] - x;
+		}
+	}
+	else
+	{
+		for (int32 f=0; f<frames; f++)
+		{
+			SampleType x = cdep * blockD[f];  //stereo simulator
+
+			out0[f] = mixL[f] + x;// 输出到左声道
+			out1[f] = mixR[f] - x;// 输出到右声道
+		}
 	}
-	/*这行代码使用一个 for 循环，从 0 到 synthData.activevoices - 1 遍历所有活跃的声部。synthData.activevoices 表示当前活跃的声部数量。*/
-	for(v=0; v<synthData.activevoices; v++) 
-		/*这行代码检查当前声部的包络值（env）是否小于 SILENCE。
-		SILENCE 是一个预定义的常量（在上文提到 #define SILENCE 0.0001f），表示静默阈值。如果包络值小于这个阈值，说明该声部的音量已经很小，接近静默状态。*/
-		if (synthData.voice[v].env < SILENCE) 
-			/*--synthData.activevoices：先将 synthData.activevoices 减 1，表示减少一个活跃声部。
-			synthData.voice[v] = synthData.voice[synthData.activevoices]：将最后一个活跃声部的数据复制到当前声部位置，以覆盖当前处于静默状态的声部。
-			通过以上步骤，代码移除了当前活跃声部列表中处于静默状态的声部，并确保剩余的活跃声部被正确地管理和更新。*/
-			synthData.voice[v] = synthData.voice[--synthData.activevoices];
 }
 
 //-----------------------------------------------------------------------------
@@ -459,8 +1526,8 @@ void PianoProcessor::noteEvent (const Event& event)
 	先处理MIDI事件：当MIDI事件到达时，系统会立即调用 noteEvent 函数，以确保合成器的状态及时更新。这意味着noteEvent 会在 doProcessing 之前被执行。
 	随后处理音频缓冲：在处理MIDI事件之后，音频引擎会在下一个音频缓冲周期调用 doProcessing 函数，以生成音频输出。
 	*/
-	float l=99.0f;
-	int32  v, vl=0, k, s;
+	int32  v, vl=0, k, s, count;
+	int32 slots[kNumVoices];
 
 	if (event.type == Event::kNoteOnEvent)
 	{/*NoteOn 事件处理：当接收到 NoteOn 事件时，生成新的音符，或在活跃声部已满时，取代音量最小的活跃声部。
@@ -474,81 +1541,122 @@ void PianoProcessor::noteEvent (const Event& event)
 		auto& noteOn = event.noteOn;
 		auto note = noteOn.pitch;
 		float velocity = noteOn.velocity * 127;
-
-		/*添加或替换活跃声部：*/
-		if (synthData.activevoices < poly) //add a note
+		blockStats.noteOns++;
+		int32 part = noteOn.channel >= 0 && noteOn.channel < kNumParts ? noteOn.channel : 0;
+		Part& P = parts[part];
+
+		/*添加或替换活跃声部：每个声部组合最多 poly 个声部，所有组合共用 kNumVoices 个声部；
+		自适应复音打开时，总数上限是 CPU 预算给出的上限。组合自己的声部用满时在组合内抢占，
+		共用的声部用满时抢占所有组合里最安静的一个。*/
+		auto envOf = [this] (int32 i) { return synthData.voice[i].env; };
+		int32 voiceCap = voiceBudget.isEnabled () ? std::min<int32> (kNumVoices, voiceBudget.getCap ()) : kNumVoices;
+		if (P.voices < P.snapshot->poly && synthData.activevoices < voiceCap) //add a note
 		{
 			vl = synthData.activevoices;
 			synthData.activevoices++;
 		}
 		else //steal a note
 		{
-			for(v=0; v<poly; v++)  //find quietest voice
-			{
-				if (synthData.voice[v].env < l) { l = synthData.voice[v].env;  vl = v; }
-			}
+			//find quietest voice：quietVoices 按 env 的量级分桶，只需在最低的非空桶里比较
+			if (P.voices >= P.snapshot->poly)
+				vl = quietVoices.findQuietest (kNumVoices, envOf, [this, part] (int32 i) { return synthData.voice[i].part == part; });
+			else
+				vl = quietVoices.findQuietest (kNumVoices, envOf);
+			if (vl < 0) vl = 0;
+			blockStats.steals++;
+			noteIds.erase (vl);
+			sustained.reset (vl);
+			shedding.reset (vl);
+			parts[synthData.voice[vl].part].voices--;
 		}
-
-		//计算调音参数：
-		k = (note - 60) * (note - 60);
-		l = fine + random * ((float)(k % 13) - 6.5f);  //random & fine tune
-		if (note > 60) l += stretch * (float)k; //stretch
+		P.voices++;
+
+		/*系数查表：tables 在 recalculate () 里按音符 (0-127) 和整数力度 (0-127) 预先算好，
+		note-on 不再调用 exp/pow，也不再线性查找键组。宿主给出非整数力度（高精度力度）时逐项现算，
+		两条路径调用同一组函数，结果逐位相同。*/
+		VOICE& V = synthData.voice[vl];
+		const Snapshot& S = *P.snapshot;
+		const NoteTables& tables = S.tables;
+		V.part = part;
+		int32 vel = (int32)velocity;
+		bool noteInTable = note >= 0 && note < kNumNotes;
+		bool velInTable = vel >= 0 && vel < kNumNotes && (float)vel == velocity;
 
 		//调整尺寸参数：
-		s = size;
-		if (velocity > 40) s += (int32)(sizevel * (float)(velocity - 40));  
-
-
-		//查找键组：
-		k = 0;
-		while (note > (kgrp[k].high + s)) k++;  //find keygroup
-
-		//计算频率和波形位置：
-		l += (float)(note - kgrp[k].root); //pitch
-		l = 22050.0f * iFs * (float)exp (0.05776226505 * l);
-		synthData.voice[vl].delta = (int32)(65536.0f * l);
-		synthData.voice[vl].frac = 0;
-		synthData.voice[vl].pos = kgrp[k].pos;
-		synthData.voice[vl].end = kgrp[k].end;
-		synthData.voice[vl].loop = kgrp[k].loop;
-
-		//设置包络和滤波参数：
-		synthData.voice[vl].env = (0.5f + velsens) * (float)pow (0.0078f * velocity, velsens); //velocity
-		l = 50.0f + params[4] * params[4] * muff + muffvel * (float)(velocity - 64); //muffle
-		if (l < (55.0f + 0.25f * (float)note)) l = 55.0f + 0.25f * (float)note;
-		if (l > 210.0f) l = 210.0f;
-		synthData.voice[vl].ff = l * l * iFs;
-		synthData.voice[vl].f0 = synthData.voice[vl].f1 = 0.0f;
+		s = velInTable ? tables.size[vel] : velocitySize (S, velocity);
 
+		//查找键组，计算频率和波形位置（调音 fine/random/stretch 已经并入 tables.tune），
+		//delta 太大时改读降采样的副本（表里已经换好级别）：
+		if (noteInTable && s >= kMinSize && s <= kMaxSize)
+		{
+			V.delta = tables.delta[note][s - kMinSize];
+			k = tables.mipGroup[note][s - kMinSize];
+		}
+		else
+		{
+			k = note - s + kKeygroupBias;
+			k = (k >= 0 && k < 256) ? tables.keygroup[k] : findKeygroup (note, s);
+			V.delta = noteDelta (S, note, k);
+			k = mipKeygroup (k, V.delta);
+		}
+		V.frac = 0;
+		V.pos = kgrp[k].pos;
+		V.end = kgrp[k].end;
+		V.loop = kgrp[k].loop;
+		V.cursor.reset (k);
+
+		//设置包络和滤波参数（muffle 随调制轮变化，只有力度部分查表，记在 fvel 里供调制轮重算）：
+		V.env = velInTable ? tables.env[vel] : velocityEnv (S, velocity); //velocity
+		V.fvel = velInTable ? tables.muff[vel] : velocityMuff (S, velocity);
+		V.ff = voiceCutoff (P, note, V.fvel); //muffle
+		V.f0 = V.f1 = 0.0f;
 
 		//设置音符和立体声输出参数：
-		synthData.voice[vl].note = note; //note->pan
-		if (note <  12) note = 12;
-		if (note > 108) note = 108;
-		l = volume * trim;
-		synthData.voice[vl].outr = l + l * width * (float)(note - 60);
-		synthData.voice[vl].outl = l + l - synthData.voice[vl].outr;
+		V.note = note; //note->pan
+		if (noteInTable)
+		{
+			V.outl = tables.outl[note];
+			V.outr = tables.outr[note];
+		}
+		else
+			notePan (S, note, V.outl, V.outr);
 
 		//设置衰减参数：
-		if (note < 44) note = 44; //limit max decay length
-		l = 2.0f * params[0];
-		if (l < 1.0f) l += 0.25f - 0.5f * params[0];
-		synthData.voice[vl].dec = (float)exp (-iFs * exp (-0.6 + 0.033 * (double)note - l));
-		synthData.voice[vl].noteID = noteOn.noteId;
+		V.dec = noteInTable ? tables.dec[note] : noteDecay (S, note);
+		V.hdec = V.dec;
+		V.noteID = noteOn.noteId;
+		noteIds.insert (noteOn.noteId, vl);
+		quietVoices.update (vl, synthData.voice[vl].env);
 	}
 	else //note off
 	{
 		auto& noteOff = event.noteOff;
 		auto note = noteOff.pitch;
-		for(v=0; v<synthData.numVoices; v++) if (synthData.voice[v].noteID==noteOff.noteId) //any voices playing that note?
+		int32 part = noteOff.channel >= 0 && noteOff.channel < kNumParts ? noteOff.channel : 0;
+		Part& P = parts[part];
+		count = noteIds.find (noteOff.noteId, slots); //any voices playing that note?
+		int32 released = 0;
+		for (int32 i = 0; i < count; i++)
 		{
-			if (synthData.sustain==0)
+			v = slots[i];
+			if (synthData.voice[v].part != part)
+				continue;	//another channel's note with the same noteId
+			released++;
+			noteIds.erase (v);
+			if (P.pedal <= 0.0f)
 			{
 				if (note < 94) //no release on highest notes
-				synthData.voice[v].dec = (float)exp (-iFs * exp (2.0 + 0.017 * (double)note - 2.0 * params[1]));
+				synthData.voice[v].dec = (note >= 0) ? P.snapshot->tables.release[note] : noteRelease (*P.snapshot, note);
+			}
+			else
+			{
+				//键松开但踏板踩着：声部进入 sustained 集合，noteID 保持不变；半踏板时只给这个声部按踏板深度算衰减
+				sustained.set (v);
+				if (P.pedal < 1.0f)
+					synthData.voice[v].dec = pedalDecay (P, v, P.pedal);
 			}
-			else synthData.voice[v].noteID = SustainNoteID;
 		}
+		if (released == 0) blockStats.missedNoteOffs++;
 	}
 	//### 总结 
 	//- **NoteOn 事件**：增加或替换活跃声部，计算和设置相关参数（频率、波形、包络、滤波等），并初始化音符相关的内部状态。 
@@ -556,6 +1664,54 @@ void PianoProcessor::noteEvent (const Event& event)
 	//这段代码确保了在接收到 MIDI 事件时，合成器能够正确生成或停止音符，实现流畅的音频播放和控制。
 }
 
+//-----------------------------------------------------------------------------
+void PianoProcessor::sustainEvent (Part& P, float value)
+{
+	/*
+	延音踏板。value 是 kSustainParam 的值，0.25 以下为完全抬起，0.75 以上为完全踩下，中间是半踏板。
+	pedal > 0 时松开的键进入 sustained 集合；只有这些声部会被踏板改写衰减，按住的键不受影响。
+	衰减率在两个极端之间按对数插值：
+	pedal = 1：保持按键时的衰减 hdec（和原来踩住踏板一样）
+	pedal = 0：制音器落下，dec = exp (-iFs * exp (6.0 + 0.01 * note - 5.0 * params[1]))，随后离开 sustained 集合
+	*/
+	float depth = 2.0f * (value - 0.25f);
+	if (depth < 0.0f) depth = 0.0f;
+	if (depth > 1.0f) depth = 1.0f;
+	applyPedal (P, depth);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::applyPedal (Part& P, float depth)
+{
+	//depth 是已经换算好的踏板深度 0..1（sustainEvent 换算控制器的值），按它改写 sustained 集合里声部的衰减
+	P.pedal = depth;
+
+	//踏板只作用于这个声部组合的声部
+	int32 part = (int32)(&P - parts);
+	for (int32 v = sustained.next (0); v != -1; v = sustained.next (v + 1))
+	{
+		VOICE& V = synthData.voice[v];
+		if (V.part != part)
+			continue;
+		V.dec = pedalDecay (P, v, depth);
+		if (depth <= 0.0f)
+			sustained.reset (v);
+	}
+}
+
+//-----------------------------------------------------------------------------
+float PianoProcessor::pedalDecay (const Part& P, int32 v, float depth) const
+{
+	//sustained 集合里一个声部在踏板深度 depth 时的衰减：1 保持 hdec，0 是制音器落下的 pedalRelease，中间按对数插值
+	const VOICE& V = synthData.voice[v];
+	float release = (V.note >= 0 && V.note < kNumNotes) ? P.snapshot->tables.pedalRelease[V.note] : notePedalRelease (*P.snapshot, V.note);
+	if (depth <= 0.0f)
+		return release;
+	if (depth >= 1.0f)
+		return V.hdec;
+	return (float)exp (depth * log ((double)V.hdec) + (1.0 - depth) * log ((double)release));
+}
+
 //-----------------------------------------------------------------------------
 void PianoProcessor::preProcess ()
 {
@@ -573,7 +1729,17 @@ void PianoProcessor::allNotesOff ()
 {
   for (int32 v=0; v<synthData.numVoices; v++) synthData.voice[v].dec=0.99f;
   synthData.sustain = 0;
-  muff = 160.0f;
+  sustained.clear ();
+  flushControls ();
+  for (int32 p=0; p<kNumParts; p++)
+  {
+    Part& P = parts[p];
+    P.pedal = 0.0f;
+    P.muff = 160.0f;
+    P.sustainValue = P.modWheelValue = -1.0;
+    P.muffleTarget = P.params[4] * P.params[4] * P.muff;
+  }
+  snapControls ();
 }
 
 //-----------------------------------------------------------------------------
@@ -622,23 +1788,280 @@ void PianoProcessor::recalculate ()
 	作用：计算复音数 poly。
 	解释：复音数是指合成器可以同时生成的最大音符数量。通过将 params[8] 乘以 24.9，然后加上 8，再转换为整数类型。
 	
+	原来每次都把上面这些值全部重算。现在这些值和表放在快照（Snapshot）里：每个程序一份，由 buildPrograms 预先生成；
+	声部组合的参数和程序不同时（改过参数）用自己的 edited。updateSnapshot 先和快照的 params 逐个比较得到改动位 changed，
+	只重算改动的参数派生出来的值，再按 paramDirty 只重建受影响的表；参数没变时只做 12 次比较。
+	cdep 和 Muffling 只设置目标值（snapshot->cdep、muffleTarget），由 smoothControls 每个子块平滑过去。
 	*/
-	size = (int32)(12.0f * params[2] - 6.0f);
-	sizevel = 0.12f * params[3];
-	muffvel = params[5] * params[5] * 5.0f;
+	for (int32 p = 0; p < kNumParts; p++)
+		recalculatePart (parts[p]);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::recalculatePart (Part& P)
+{
+	/*参数和当前快照相同时什么都不做；和程序的快照相同（刚换了程序，或改回了程序的值）时换成程序的快照；
+	否则在 edited 上增量更新（从当前快照抄一份，只重建改动的部分）。*/
+	const ParamValue* params = P.params;
+	if (!P.snapshot->matches (params, Fs))
+	{
+		const Snapshot& program = programs[P.program];
+		if (program.matches (params, Fs))
+			P.snapshot = &program;
+		else
+		{
+			if (P.snapshot != &P.edited)
+				P.edited = *P.snapshot;
+			updateSnapshot (P.edited, params);
+			P.snapshot = &P.edited;
+		}
+	}
+	P.muffleTarget = params[4] * params[4] * P.muff;
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::buildPrograms ()
+{
+	//非音频线程（initialize、setActive）：每个程序按当前 Fs 和键组生成快照，之后换程序不用再算
+	for (int32 n = 0; n < kNumPrograms; n++)
+	{
+		ParamValue values[NPARAMS];
+		for (int32 i = 0; i < NPARAMS; i++)
+			values[i] = programParams[n][i];
+		updateSnapshot (programs[n], values);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::updateSnapshot (Snapshot& S, const ParamValue* params)
+{
+	uint32 changed = 0;
+	for (int32 i = 0; i < NPARAMS; i++)
+	{
+		if (params[i] != S.params[i])
+		{
+			changed |= 1u << i;
+			S.params[i] = params[i];
+		}
+	}
+
+	if (changed & (1 << 2)) S.size = (int32)(12.0f * params[2] - 6.0f);
+	if (changed & (1 << 3)) S.sizevel = 0.12f * params[3];
+	if (changed & (1 << 5)) S.muffvel = params[5] * params[5] * 5.0f;
+
+	if (changed & (1 << 6))
+	{
+		S.velsens = 1.0f + params[6] + params[6];
+		if (params[6] < 0.25f) S.velsens -= 0.75f - 3.0f * params[6];
+	}
+
+	if (changed & (1 << 9)) S.fine = params[9] - 0.5f;
+	if (changed & (1 << 10)) S.random = 0.077f * params[10] * params[10];
+	if (changed & (1 << 11)) S.stretch = 0.000434f * (params[11] - 0.5f);
+
+	if (changed & (1 << 7))
+	{
+		S.cdep = params[7] * params[7];
+		S.trim = 1.50f - 0.79f * S.cdep;
+		S.width = 0.04f * params[7];  if (S.width > 0.03f) S.width = 0.03f;
+	}
+
+	if (changed & (1 << 8))
+		S.poly = 8 + (int32)((kNumVoices - 32 + 24.9f) * params[8]);	//kNumVoices = 32 时与原来的 24.9f 完全相同
+
+	//只重建受改动参数影响的表
+	static const uint32 paramDirty[NPARAMS] = {
+		kDecayDirty,	//Envelope Decay
+		kReleaseDirty,	//Envelope Release
+		kSizeDirty,	//Hardness Offset
+		kSizeDirty,	//Velocity to Hardness
+		0,		//Muffling Filter：和调制轮的 muff 一起平滑（muffle），不进表
+		kMuffDirty,	//Velocity to Muffling
+		kEnvDirty,	//Velocity Sensitivity
+		kPanDirty,	//Stereo Width
+		0,		//Polyphony
+		kTuneDirty,	//Fine Tuning
+		kTuneDirty,	//Random Detuning
+		kTuneDirty,	//Stretch Tuning
+	};
+	uint32 dirty = 0;
+	for (int32 i = 0; i < NPARAMS; i++)
+	{
+		if (changed & (1u << i))
+			dirty |= paramDirty[i];
+	}
+	if (Fs != S.Fs)
+	{
+		dirty |= kSampleRateDirty;
+		S.Fs = Fs;
+	}
+	if (dirty)
+		updateNoteTables (S, dirty);
+}
+
+//-----------------------------------------------------------------------------
+void PianoProcessor::updateNoteTables (Snapshot& S, uint32 dirty)
+{
+	NoteTables& tables = S.tables;
+	int32 n, s, k;
+	if (dirty & kTuneDirty)
+	{
+		for (n = 0; n < kNumNotes; n++)
+			tables.tune[n] = noteTune (S, n);
+	}
+	if (dirty & kSizeDirty)
+	{
+		for (n = 0; n < kNumNotes; n++)
+			tables.size[n] = velocitySize (S, (float)n);
+		//键组只取决于 note - s，和 size 表放在一起建
+		for (n = 0; n < 256; n++)
+			tables.keygroup[n] = (uint8)findKeygroup (n - kKeygroupBias, 0);
+	}
+	if (dirty & (kTuneDirty | kSizeDirty))
+	{
+		/*delta 按 [音符][s] 存，不按键组：一个音符用到的键组只有 note - s 能取到的那几个，
+		表的大小和音色库有多少个键组无关（外部音色库最多 kSampleBankMaxKeygroups 个）。*/
+		for (n = 0; n < kNumNotes; n++)
+		{
+			for (s = kMinSize; s <= kMaxSize; s++)
+			{
+				k = tables.keygroup[n - s + kKeygroupBias];
+				int32& delta = tables.delta[n][s - kMinSize];
+				delta = noteDelta (S, n, k);
+				tables.mipGroup[n][s - kMinSize] = (uint16)mipKeygroup (k, delta);
+			}
+		}
+	}
+	if (dirty & kEnvDirty)
+	{
+		for (n = 0; n < kNumNotes; n++)
+			tables.env[n] = velocityEnv (S, (float)n);
+	}
+	if (dirty & kMuffDirty)
+	{
+		for (n = 0; n < kNumNotes; n++)
+			tables.muff[n] = velocityMuff (S, (float)n);
+	}
+	if (dirty & kPanDirty)
+	{
+		for (n = 0; n < kNumNotes; n++)
+			notePan (S, n, tables.outl[n], tables.outr[n]);
+	}
+	if (dirty & kDecayDirty)
+	{
+		for (n = 0; n < kNumNotes; n++)
+			tables.dec[n] = noteDecay (S, n);
+	}
+	if (dirty & kReleaseDirty)
+	{
+		for (n = 0; n < kNumNotes; n++)
+		{
+			tables.release[n] = noteRelease (S, n);
+			tables.pedalRelease[n] = notePedalRelease (S, n);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+float PianoProcessor::noteTune (const Snapshot& S, int32 note) const
+{
+	//计算调音参数（“随机”失谐其实由音高决定，可以进表）：
+	int32 k = (note - 60) * (note - 60);
+	float l = S.fine + S.random * ((float)(k % 13) - 6.5f);  //random & fine tune
+	if (note > 60) l += S.stretch * (float)k; //stretch
+	return l;
+}
+
+//-----------------------------------------------------------------------------
+int32 PianoProcessor::noteDelta (const Snapshot& S, int32 note, int32 k) const
+{
+	float l = noteTune (S, note);
+	l += (float)(note - kgrp[k].root); //pitch
+	l = waveRate * iFs * (float)exp (0.05776226505 * l);	//内置音色库 waveRate = 22050
+	return (int32)(65536.0f * l);
+}
+
+//-----------------------------------------------------------------------------
+int32 PianoProcessor::velocitySize (const Snapshot& S, float velocity) const
+{
+	int32 s = S.size;
+	if (velocity > 40) s += (int32)(S.sizevel * (float)(velocity - 40));
+	return s;
+}
+
+//-----------------------------------------------------------------------------
+int32 PianoProcessor::findKeygroup (int32 note, int32 s) const
+{
+	int32 k = 0;
+	while (k < numKeygroups - 1 && note > (kgrp[k].high + s)) k++;  //find keygroup (the last group takes everything above)
+	return k;
+}
 
-	velsens = 1.0f + params[6] + params[6];
-	if (params[6] < 0.25f) velsens -= 0.75f - 3.0f * params[6];
+//-----------------------------------------------------------------------------
+int32 PianoProcessor::mipKeygroup (int32 k, int32& delta) const
+{
+	//每级副本的采样率减半：delta 超过 √2 就往下一级，读到的步长保持在 0.7~1.4 之间（最后一级不再限制）
+	for (int32 level = 1; level < numMipLevels && delta > kMipDelta; level++)
+	{
+		delta >>= 1;
+		k += numKeygroups;
+	}
+	return k;
+}
 
-	fine = params[9] - 0.5f;
-	random = 0.077f * params[10] * params[10];
-	stretch = 0.000434f * (params[11] - 0.5f);
+//-----------------------------------------------------------------------------
+float PianoProcessor::velocityEnv (const Snapshot& S, float velocity) const
+{
+	return (0.5f + S.velsens) * (float)pow (0.0078f * velocity, S.velsens); //velocity
+}
 
-	cdep = params[7] * params[7];
-	trim = 1.50f - 0.79f * cdep;
-	width = 0.04f * params[7];  if (width > 0.03f) width = 0.03f;
+//-----------------------------------------------------------------------------
+float PianoProcessor::velocityMuff (const Snapshot& S, float velocity) const
+{
+	return S.muffvel * (float)(velocity - 64);
+}
 
-	poly = 8 + (int32)(24.9f * params[8]);
+//-----------------------------------------------------------------------------
+void PianoProcessor::notePan (const Snapshot& S, int32 note, float& outl, float& outr) const
+{
+	if (note <  12) note = 12;
+	if (note > 108) note = 108;
+	float l = S.volume * S.trim;
+	outr = l + l * S.width * (float)(note - 60);
+	outl = l + l - outr;
+}
+
+//-----------------------------------------------------------------------------
+float PianoProcessor::noteDecay (const Snapshot& S, int32 note) const
+{
+	if (note <  12) note = 12;
+	if (note > 108) note = 108;
+	if (note < 44) note = 44; //limit max decay length
+	float l = 2.0f * S.params[0];
+	if (l < 1.0f) l += 0.25f - 0.5f * S.params[0];
+	return (float)exp (-iFs * exp (-0.6 + 0.033 * (double)note - l));
+}
+
+//-----------------------------------------------------------------------------
+float PianoProcessor::voiceCutoff (const Part& P, int32 note, float fvel) const
+{
+	//闷音滤波系数：muffle 部分随调制轮平滑变化，力度部分 fvel 在 note-on 时定下
+	float l = 50.0f + P.muffle + fvel;
+	if (l < (55.0f + 0.25f * (float)note)) l = 55.0f + 0.25f * (float)note;
+	if (l > 210.0f) l = 210.0f;
+	return l * l * iFs;
+}
+
+//-----------------------------------------------------------------------------
+float PianoProcessor::noteRelease (const Snapshot& S, int32 note) const
+{
+	return (float)exp (-iFs * exp (2.0 + 0.017 * (double)note - 2.0 * S.params[1]));
+}
+
+//-----------------------------------------------------------------------------
+float PianoProcessor::notePedalRelease (const Snapshot& S, int32 note) const
+{
+	return (float)exp (-iFs * exp (6.0 + 0.01 * (double)note - 5.0 * S.params[1]));
 }
 
 }}} // namespaces
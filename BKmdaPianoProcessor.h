@@ -0,0 +1,412 @@
+/*
+ *  mdaPianoProcessor.h
+ *  mda-vst3
+ *
+ *  Created by Arne Scheffler on 6/14/08.
+ *
+ *  mda VST Plug-ins
+ *
+ *  Copyright (c) 2008 Paul Kellett
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *  The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "mdaBaseProcessor.h"
+#include "BKmdaPianoVoiceKernel.h"
+#include "BKmdaPianoFaultMonitor.h"
+#include "BKmdaPianoVoiceMap.h"
+#include "BKmdaPianoDelayLine.h"
+#include "BKmdaPianoRenderPool.h"
+#include "BKmdaPianoSampleBank.h"
+#include "BKmdaPianoSampleCache.h"
+#include "BKmdaPianoCompressedBank.h"
+#include "BKmdaPianoVoiceBudget.h"
+#include "BKmdaPianoTelemetry.h"
+#include "BKmdaPianoLiveEvents.h"
+#include "BKmdaPianoTrace.h"
+
+#include <vector>
+
+#ifndef MDA_PIANO_NUM_VOICES
+#define MDA_PIANO_NUM_VOICES 32	//extended builds raise this; must be a multiple of kVoiceLanes
+#endif
+#ifndef MDA_PIANO_RENDER_THREADS
+#define MDA_PIANO_RENDER_THREADS 0	//default worker threads for voice rendering, 0 = render on the audio thread only
+#endif
+#ifndef MDA_PIANO_ADAPTIVE_POLY
+#define MDA_PIANO_ADAPTIVE_POLY 0	//1 = start with the CPU-budget voice cap enabled
+#endif
+#ifndef MDA_PIANO_TELEMETRY
+#define MDA_PIANO_TELEMETRY 0	//1 = start with per-block telemetry enabled
+#endif
+#ifndef MDA_PIANO_COMPRESSED_SAMPLES
+#define MDA_PIANO_COMPRESSED_SAMPLES 0	//1 = default to the compressed sample store instead of the unrolled SampleCache
+#endif
+#ifndef MDA_PIANO_NUM_PARTS
+#define MDA_PIANO_NUM_PARTS 1	//multitimbral builds raise this (up to 16): part p plays MIDI channel p and has its own output bus
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+class PianoProcessor : public BaseProcessor
+{
+public:
+	typedef BaseProcessor Base;
+
+	PianoProcessor ();
+	~PianoProcessor ();
+
+	tresult PLUGIN_API initialize (FUnknown* context) SMTG_OVERRIDE;
+	tresult PLUGIN_API terminate () SMTG_OVERRIDE;
+	tresult PLUGIN_API setActive (TBool state) SMTG_OVERRIDE;
+	tresult PLUGIN_API setupProcessing (ProcessSetup& newSetup) SMTG_OVERRIDE;
+
+	tresult PLUGIN_API canProcessSampleSize (int32 symbolicSampleSize) SMTG_OVERRIDE;
+	tresult PLUGIN_API process (ProcessData& data) SMTG_OVERRIDE;
+	void doProcessing (ProcessData& data) SMTG_OVERRIDE;
+
+	static FUnknown* createInstance (void*) { return (IAudioProcessor*)new PianoProcessor; }
+	static FUID uid;
+
+	//NaN/overflow statistics, safe to read from any thread
+	const FaultMonitor& getFaultMonitor () const { return faultMonitor; }
+
+	//worker threads for voice rendering (0 = off); takes effect on the next setActive (true).
+	//All instances share one pool, which runs the largest count any of them asked for
+	void setRenderThreads (int32 numWorkers) { renderThreads = numWorkers; }
+	int32 getRenderThreads () const { return renderThreads; }
+
+	//adaptive polyphony: enable, set the load limit and read cap/shed statistics from any thread
+	VoiceBudget& getVoiceBudget () { return voiceBudget; }
+	const VoiceBudget& getVoiceBudget () const { return voiceBudget; }
+
+	//per-block stats; enable from any thread, read () from exactly one reader thread
+	Telemetry& getTelemetry () { return telemetry; }
+
+	//compressed sample store; takes effect on the next initialize
+	void setCompressedSamples (bool state) { compressedSamples = state; }
+	bool getCompressedSamples () const { return compressedSamples; }
+	uint64 getSampleMemory () const;	//bytes of sample data the voices read from (shared parts included)
+	const FrameCache& getFrameCache () const { return frameCache; }	//decode statistics
+
+	//multitimbral parts: part 0 is the plugin's own parameters, every part also answers to
+	//partParamID (part, index) with index < NPARAMS, kPartProgram, kPartModWheel or kPartSustain
+	enum {
+		kNumParts = MDA_PIANO_NUM_PARTS,
+		kPartParamBase = 1000,
+		kPartParamStride = 16,
+		kPartProgram = 12,
+		kPartModWheel,
+		kPartSustain
+	};
+	static ParamID partParamID (int32 part, int32 index) { return kPartParamBase + part * kPartParamStride + index; }
+
+	//standalone/live rendering: one feeder thread pushes timestamped events, the audio thread drains them every block;
+	//getLiveTime () is the render clock (seconds rendered since setActive) the timestamps refer to
+	LiveEventQueue& getLiveEvents () { return liveEvents; }
+	uint64 getControlOverflows () const { return controlOverflows.load (std::memory_order_relaxed); }	//parameter queue full, any thread
+	double getLiveTime () const { return (double)liveFrames.load (std::memory_order_relaxed) * iFs; }
+
+	//binary trace of every block's input for offline replay (tools/BKmdaPianoReplay.cpp);
+	//enable before setActive (true), flush () from exactly one reader thread
+	TraceRecorder& getTraceRecorder () { return traceRecorder; }
+	//build and sample bank fields of a start record (numParts, numVoices, numMipLevels, bank*), valid after initialize
+	void getTraceIdentity (TraceStart& start) const;
+
+	//trace replay: a part's program and parameters as recorded at setActive (call while inactive), a recorded control
+	//change (before the setActive or process () it belongs to) and the cap to end the next blocks with (-1 = measure)
+	void setPartState (int32 part, uint32 program, const ParamValue* values);
+	void replayControl (int32 part, ParamID id, ParamValue value, int32 sampleOffset) { queueControl (part, id, value, sampleOffset); }
+	void replayEarlyControl (int32 part, ParamID id, ParamValue value) { applyControl (part, id, value); }	//a change the full queue applied at once
+	void setReplayVoiceCap (int32 cap) { replayVoiceCap = cap; }
+
+protected:
+	void setParameter (ParamID index, ParamValue newValue, int32 sampleOffset) SMTG_OVERRIDE;
+	void setCurrentProgram (Steinberg::uint32 val) SMTG_OVERRIDE;
+	void setCurrentProgramNormalized (ParamValue val) SMTG_OVERRIDE;
+	void preProcess () SMTG_OVERRIDE;
+	void processEvent (const Event& e) SMTG_OVERRIDE;
+	void recalculate () SMTG_OVERRIDE;
+
+	struct Part;
+	struct Snapshot;
+	struct ControlChange;
+
+	void noteEvent (const Event& event);
+	void sustainEvent (Part& P, float value);
+	void applyPedal (Part& P, float depth);
+	float pedalDecay (const Part& P, int32 v, float depth) const;
+	void queueParameterChanges (IParameterChanges* changes);
+	bool mapControl (ParamID index, int32& part, ParamID& id) const;
+	void queueControl (int32 part, ParamID id, ParamValue value, int32 sampleOffset);
+	void applyEarlyControl (const ControlChange& change);
+	void drainLiveEvents (int32 sampleFrames);
+	void traceStart ();
+	void traceBlock (const ProcessData& data, const bool* mix, int32 numControls, int32 voiceCap, uint32 renderNs);
+	void applyControl (int32 part, ParamID id, ParamValue value);
+	void selectProgram (Part& P, uint32 program);
+	void recalculatePart (Part& P);
+	void buildPrograms ();
+	void updateSnapshot (Snapshot& S, const ParamValue* params);
+	void flushControls ();
+	void smoothControls (int32 frames);
+	void smoothPart (int32 part, int32 frames);
+	void snapControls ();
+	void allNotesOff ();
+	bool acquireSampleBank ();
+	void removeVoice (int32 v);
+	void retireVoices ();
+	void shedVoices (int32 cap);
+	static int32 framesUntilSilent (float env, float dec);
+	void clearVoiceIndex ();
+
+	//per-note coefficients of a snapshot; its tables cache these for integer pitch/velocity
+	float noteTune (const Snapshot& S, int32 note) const;
+	int32 noteDelta (const Snapshot& S, int32 note, int32 k) const;
+	int32 velocitySize (const Snapshot& S, float velocity) const;
+	int32 findKeygroup (int32 note, int32 s) const;
+	int32 mipKeygroup (int32 k, int32& delta) const;
+	float velocityEnv (const Snapshot& S, float velocity) const;
+	float velocityMuff (const Snapshot& S, float velocity) const;
+	void notePan (const Snapshot& S, int32 note, float& outl, float& outr) const;
+	float noteDecay (const Snapshot& S, int32 note) const;
+	float noteRelease (const Snapshot& S, int32 note) const;
+	float notePedalRelease (const Snapshot& S, int32 note) const;
+	float voiceCutoff (const Part& P, int32 note, float fvel) const;
+	void updateNoteTables (Snapshot& S, uint32 dirty);
+
+	void packVoices ();
+	void unpackVoices ();
+	void renderVoices (int32 frames);
+	void stageVoices (int32 frames);
+	void unstageVoices ();
+	void mixLanes (const float* l, const float* r, int32 first, int32 count, int32 frames);
+	static void renderGroupJob (void* context, int32 group);
+	void checkVoiceMix (int32 frames);
+	//output stage, instantiated for Sample32 and Sample64; voices always render in float
+	template <typename SampleType> struct PartOutputs;
+	template <typename SampleType> void renderBlock (ProcessData& data);
+	template <typename SampleType> void routeParts (ProcessData& data, PartOutputs<SampleType>& outputs);
+	template <typename SampleType> void renderParts (PartOutputs<SampleType>& outputs, int32 offset, int32 frames);
+	template <typename SampleType> void renderStereo (Part& P, SampleType* out0, SampleType* out1, int32 frames, bool mix);
+	template <typename SampleType> void renderIdle (ProcessData& data, PartOutputs<SampleType>& outputs, int32 frames);
+
+	enum {
+		NPARAMS = 12,
+		kNumPrograms = 8,
+		kNumVoices = MDA_PIANO_NUM_VOICES,
+		kNumLaneGroups = kNumVoices / kVoiceLanes,
+		kMinParallelGroups = 4,	//fewer active lane groups render on the audio thread (dispatch costs more than it saves)
+		kBlockSize = 128,	//max frames rendered per voice pass
+		kStageEntries = 4 * kBlockSize + 2,	//staged sample pairs per voice and pass (compressed samples)
+		kFrameCacheSlots = 4 * kNumVoices,	//decoded frames kept for the voices (compressed samples)
+		kControlPoints = 4,	//queued points per parameter and part, any block size
+		kControlRamps = 4,	//plus this many parameters with a point on every frame of the largest block
+		kMinControlChanges = kControlPoints * kNumParts * (NPARAMS + 3),	//parameter, program, mod wheel and sustain changes queued per block
+		kNumNotes = 128,
+		kMinSize = -6,	//keygroup shift s: Hardness Offset gives -6..6,
+		kMaxSize = 6 + 10,	//Velocity to Hardness adds up to 0.12 * (127 - 40)
+		kSizeRange = kMaxSize - kMinSize + 1,
+		kKeygroupBias = 64,	//keygroup table index is note - s + kKeygroupBias
+		kMipDelta = 92682,	//sqrt(2) in 16.16: faster voices read the next pitch mip level
+		SustainNoteID = -1
+	};
+
+	static_assert (kNumVoices % kVoiceLanes == 0, "voice count must fill whole lane groups");
+	static_assert (kNumParts >= 1 && kNumParts <= 16, "one part per MIDI channel");
+	static_assert ((int32)NPARAMS == (int32)kTraceParams, "trace records carry every parameter");
+
+	static float programParams[][NPARAMS];
+
+	struct VOICE  //voice state
+	{
+		int32  delta;  //sample playback
+		int32  frac;
+		int32  pos;
+		int32  end;
+		int32  loop;
+
+		float env;  //envelope
+		float dec;
+		float hdec; //decay while held by key or pedal
+
+		float f0;   //first-order LPF
+		float f1;
+		float ff;
+		float fvel; //velocity part of the muffle cutoff, ff follows the mod wheel
+
+		float outl;
+		float outr;
+		int32 note; //remember what note triggered this
+		int32 noteID;
+		int32 part; //parts[] entry that owns the voice
+		SampleCursor cursor; //decode position in the compressed store
+	};
+
+	typedef SampleBankKeygroup KGRP;  //keygroup: root, high, pos, end, loop (same layout as the bank file)
+
+	float Fs, iFs;
+
+	const KGRP* kgrp;	//keygroups in sample cache coordinates, then the pitch mip levels
+	int32 numKeygroups;	//per level
+	int32 numMipLevels;	//including the bank itself
+	const uint32* waves;	//SampleCache: waves[p] | waves[p+1] << 16, loop unrolled past end
+	float waveRate;	//sample rate of waves
+	SampleBank* bank;	//shared by all instances in the process
+	SampleCache* sampleCache;	//built from bank once, shared like bank
+	CompressedBank* compressedBank;	//instead of sampleCache when compressedSamples is on
+	FrameCache frameCache;	//decoded frames, this instance only
+	uint32* stage;	//kNumVoices * kStageEntries sample pairs; waves points here with compressed samples
+	int32 stagePos[kNumVoices];	//lane positions while the lanes point into stage
+	int32 renderLimit;	//max frames per renderVoices pass (stage capacity, set by packVoices)
+	bool compressedSamples;
+
+	SynthData<VOICE, kNumVoices> synthData;
+	NoteIdMap<kNumVoices> noteIds;	//noteID -> active voice slots
+	QuietVoiceIndex<kNumVoices> quietVoices;	//active voices bucketed by env, for stealing
+	VoiceSet<kNumVoices> sustained;	//released keys still held by the pedal
+	VoiceSet<kNumVoices> shedding;	//fading out because the voice budget was lowered
+	VoiceBudget voiceBudget;
+
+	struct ControlChange
+	{
+		int32 sampleOffset;
+		int32 part;
+		ParamID id;	//< NPARAMS, kPresetParam, kModWheelParam or kSustainParam
+		int32 order;	//arrival order, only while queueParameterChanges sorts
+		ParamValue value;
+	};
+
+	std::vector<ControlChange> controlChanges;	//sorted by sampleOffset, capacity set by setupProcessing
+	int32 numControlChanges;
+	std::atomic<uint64> controlOverflows;	//changes applied at the block start because the queue was full
+	std::vector<ControlChange> earlyControls;	//those changes in order, kept for the trace (allocated when tracing)
+	int32 numEarlyControls;
+	int32 lostEarlyControls;	//did not fit in earlyControls
+
+	LiveEventQueue liveEvents;
+	std::atomic<uint64> liveFrames;	//frames rendered since setActive, the live events' clock
+
+	TraceRecorder traceRecorder;
+	bool tracing;	//recorder was enabled at setActive (true), the trace has a start record
+	int32 replayVoiceCap;
+
+	enum NoteTableDirty
+	{
+		kTuneDirty    = 1 << 0,	//tune, delta (also rebuilt with kSizeDirty)
+		kSizeDirty    = 1 << 1,
+		kEnvDirty     = 1 << 2,
+		kMuffDirty    = 1 << 3,
+		kPanDirty     = 1 << 4,
+		kDecayDirty   = 1 << 5,
+		kReleaseDirty = 1 << 6,	//release, pedalRelease
+		kSampleRateDirty = kTuneDirty | kDecayDirty | kReleaseDirty,
+		kAllDirty     = 0x7F
+	};
+
+	struct NoteTables	//indexed by note or integer velocity
+	{
+		float tune[kNumNotes];	//fine + detune + stretch
+		int32 delta[kNumNotes][kSizeRange];	//[note][s - kMinSize], keygroup of note - s at the mip level in mipGroup
+		uint16 mipGroup[kNumNotes][kSizeRange];	//that keygroup's index including the mip level
+		int32 size[kNumNotes];	//keygroup shift s per velocity
+		uint8 keygroup[256];	//[note - s + kKeygroupBias]
+		float env[kNumNotes];
+		float muff[kNumNotes];	//velocity part of the muffle cutoff
+		float outl[kNumNotes];
+		float outr[kNumNotes];
+		float dec[kNumNotes];
+		float release[kNumNotes];
+		float pedalRelease[kNumNotes];
+	};
+
+	struct Snapshot	//everything derived from one parameter set at one sample rate; read-only while in use
+	{
+		ParamValue params[NPARAMS];	//built from, -1 = never built
+		float Fs;
+		float width, trim;
+		float cdep;	//target of the stereo simulator depth
+		int32 size, poly;
+		float fine, random, stretch;
+		float muffvel, sizevel, velsens, volume;
+		NoteTables tables;
+
+		bool matches (const ParamValue* values, float fs) const
+		{
+			for (int32 i = 0; i < NPARAMS; i++)
+				if (values[i] != params[i]) return false;
+			return fs == Fs;
+		}
+	};
+
+	Snapshot programs[kNumPrograms];	//programParams, rebuilt when Fs or the keygroups change
+
+	struct Part	//one program on one MIDI channel; voices come from the shared pool
+	{
+		ParamValue* params;	//Base::params for part 0, ownParams for the others
+		ParamValue ownParams[NPARAMS];
+		uint32 program;
+
+		const Snapshot* snapshot;	//programs[program], or edited after a parameter change
+		Snapshot edited;	//copy of the program with the part's own parameter changes
+
+		float cdep;	//stereo simulator depth, glides to snapshot->cdep block by block
+		float muff;	//mod wheel part of the muffle
+		double muffle, muffleTarget;	//params[4]^2 * muff, smoothed like cdep
+		float pedal;	//damper lift 0..1, in between is half-pedal
+		ParamValue sustainValue, modWheelValue;	//last queued, -1 = unknown; live events repeating them are dropped
+
+		int32 voices;	//active voices owned by this part
+		DelayLine stereoDelay;	//stereo simulator, sized from Fs in setActive
+		int32 stereoTail;	//frames of zeros still needed to drain stereoDelay
+
+		alignas (32) float mixL[kBlockSize];	//voice mix of this part
+		alignas (32) float mixR[kBlockSize];
+	};
+
+	template <typename SampleType>
+	struct PartOutputs	//where each part writes this block
+	{
+		SampleType* out0[kNumParts];
+		SampleType* out1[kNumParts];
+		bool mix[kNumParts];	//no bus of its own: added to bus 0 after part 0 wrote it
+	};
+
+	Part parts[kNumParts];
+
+	VoiceLanes lanes[kNumLaneGroups];	//SoA copy of the active voices while rendering
+	VoiceKernel voiceKernel;
+
+	FaultMonitor faultMonitor;
+	uint64 blockCount;
+	Telemetry telemetry;
+	BlockStats blockStats;	//block being processed; counters update even when telemetry is off
+
+	int32 silentIn;	//frames until the first packed voice can fall below SILENCE (set by packVoices)
+
+	struct alignas (64) LaneMix	//kernel output of one lane group, written by whichever thread renders it
+	{
+		float l[kBlockSize * kVoiceLanes];
+		float r[kBlockSize * kVoiceLanes];
+	};
+
+	RenderPool* renderPool;	//shared by all instances in the process, acquired while active
+	int32 renderThreads;
+	LaneMix* groupMix;	//kNumLaneGroups entries, allocated when the pool starts
+	int32 renderFrames;	//frames of the pass being dispatched
+
+	alignas (32) float blockM[kBlockSize];	//stereo simulator in/out
+	alignas (32) float blockD[kBlockSize];
+	alignas (32) float laneL[kBlockSize * kVoiceLanes];	//per-lane kernel output
+	alignas (32) float laneR[kBlockSize * kVoiceLanes];
+};
+
+}}} // namespaces
@@ -0,0 +1,270 @@
+/*
+ *  BKmdaPianoRenderPool.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoRenderPool.h"
+#include "BKmdaPianoDenormals.h"
+
+#include <chrono>
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+static const int32 kSpinCount = 20000;	//约 0.1~0.5 ms，之后工作线程睡眠
+static const std::chrono::milliseconds kSleepTimeout (2);	//错过唤醒时最多睡这么久
+
+static inline void cpuRelax ()
+{
+#if MDA_DENORMALS_MXCSR
+	_mm_pause ();
+#elif defined (__aarch64__) && !defined (_MSC_VER)
+	__asm__ __volatile__ ("yield");
+#endif
+}
+
+static std::mutex& poolMutex ()
+{
+	static std::mutex m;
+	return m;
+}
+
+static RenderPool*& sharedPool ()
+{
+	static RenderPool* pool = nullptr;
+	return pool;
+}
+
+//-----------------------------------------------------------------------------
+RenderPool::RenderPool ()
+: refCount (0)
+, numWorkers (0)
+, posted (0)
+, sleepers (0)
+, quit (false)
+, priorityTaken (false)
+, priorityVersion (0)
+, schedPolicy (0)
+, schedPriority (0)
+{
+	for (Batch& b : batches)
+	{
+		b.cursor.store (0, std::memory_order_relaxed);
+		b.doneJobs.store (0, std::memory_order_relaxed);
+		b.busy.store (false, std::memory_order_relaxed);
+		b.func = nullptr;
+		b.context = nullptr;
+	}
+}
+
+//-----------------------------------------------------------------------------
+RenderPool::~RenderPool ()
+{
+	stop ();
+}
+
+//-----------------------------------------------------------------------------
+RenderPool* RenderPool::acquire (int32 count)
+{
+	std::lock_guard<std::mutex> lock (poolMutex ());
+	RenderPool*& pool = sharedPool ();
+	if (!pool)
+		pool = new RenderPool;
+	pool->refCount++;
+	if (count > kMaxWorkers) count = kMaxWorkers;
+	if (count > (int32)pool->threads.size ())
+		pool->addWorkers (count - (int32)pool->threads.size ());
+	return pool;
+}
+
+//-----------------------------------------------------------------------------
+void RenderPool::release ()
+{
+	std::lock_guard<std::mutex> lock (poolMutex ());
+	if (--refCount > 0)
+		return;
+	sharedPool () = nullptr;
+	delete this;
+}
+
+//-----------------------------------------------------------------------------
+void RenderPool::addWorkers (int32 count)
+{
+	//已有的工作线程继续运行；新线程从下一次 run () 起参与
+	for (int32 i = 0; i < count; i++)
+		threads.emplace_back (&RenderPool::workerLoop, this);
+	numWorkers.store ((int32)threads.size (), std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+void RenderPool::stop ()
+{
+	if (threads.empty ())
+		return;
+	{
+		std::lock_guard<std::mutex> lock (sleepMutex);
+		quit.store (true);
+	}
+	wake.notify_all ();
+	for (auto& t : threads)
+		t.join ();
+	threads.clear ();
+	numWorkers.store (0, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+void RenderPool::recordPriority ()
+{
+	//音频线程只在第一次 run () 读一次自己的优先级，设置由工作线程自己去做
+	if (priorityTaken.exchange (true, std::memory_order_relaxed))
+		return;
+#if defined (_WIN32)
+	schedPriority = GetThreadPriority (GetCurrentThread ());
+#else
+	int policy;
+	sched_param param;
+	if (pthread_getschedparam (pthread_self (), &policy, &param) != 0)
+		return;
+	schedPolicy = policy;
+	schedPriority = param.sched_priority;
+#endif
+	priorityVersion.store (1, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+void RenderPool::applyPriority ()
+{
+	//没有权限（比如普通用户不能用 SCHED_FIFO）时保持原来的优先级
+#if defined (_WIN32)
+	SetThreadPriority (GetCurrentThread (), schedPriority);
+#else
+	sched_param param;
+	param.sched_priority = schedPriority;
+	pthread_setschedparam (pthread_self (), schedPolicy, &param);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+bool RenderPool::claimAndRun (Batch& b, uint32 generation)
+{
+	uint64 c = b.cursor.load (std::memory_order_acquire);
+	for (;;)
+	{
+		uint32 next = (uint32)(c & 0xFFFF);
+		uint32 jobs = (uint32)((c >> 16) & 0xFFFF);
+		if (generationOf (c) != generation || next >= jobs)
+			return false;
+		if (b.cursor.compare_exchange_weak (c, c + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			//领到任务以后，这一轮在 doneJobs 达到任务数之前不会结束，func/context 不会被改写
+			b.func (b.context, (int32)next);
+			b.doneJobs.fetch_add (1, std::memory_order_release);
+			return true;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void RenderPool::run (JobFunc f, void* ctx, int32 jobs)
+{
+	if (jobs > kMaxJobs) jobs = kMaxJobs;
+	if (jobs <= 0)
+		return;
+	Batch* b = nullptr;
+	if (numWorkers.load (std::memory_order_relaxed) > 0 && jobs > 1)
+	{
+		recordPriority ();
+		for (int32 i = 0; i < kMaxBatches && !b; i++)
+		{
+			bool expected = false;
+			if (batches[i].busy.compare_exchange_strong (expected, true, std::memory_order_acquire))
+				b = &batches[i];
+		}
+	}
+	if (!b)
+	{
+		//没有工作线程，或者同时渲染的实例太多、槽用完了
+		for (int32 j = 0; j < jobs; j++)
+			f (ctx, j);
+		return;
+	}
+
+	b->func = f;
+	b->context = ctx;
+	b->doneJobs.store (0, std::memory_order_relaxed);
+	uint32 generation = generationOf (b->cursor.load (std::memory_order_relaxed)) + 1;
+	b->cursor.store (((uint64)generation << 32) | ((uint64)jobs << 16), std::memory_order_release);
+	posted.fetch_add (1, std::memory_order_seq_cst);
+
+	//不持锁通知：极少数情况下唤醒会丢失，工作线程最多晚 kSleepTimeout 醒来，任务由本线程做完
+	if (sleepers.load (std::memory_order_seq_cst) > 0)
+		wake.notify_all ();
+
+	while (claimAndRun (*b, generation))
+		;
+	while (b->doneJobs.load (std::memory_order_acquire) < jobs)	//等别的线程手上的最后几个任务
+		cpuRelax ();
+	b->busy.store (false, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+void RenderPool::workerLoop ()
+{
+	ScopedNoDenormals noDenormals;	//与音频线程相同的 FTZ/DAZ 设置，结果与单线程一致
+	uint32 priority = 0;
+
+	while (!quit.load (std::memory_order_relaxed))
+	{
+		uint32 version = priorityVersion.load (std::memory_order_acquire);
+		if (version != priority)
+		{
+			applyPriority ();
+			priority = version;
+		}
+
+		//先记下 posted 再扫描所有槽：扫描之后才发布的批次会让 posted 变化，不会错过
+		uint32 seen = posted.load (std::memory_order_acquire);
+		bool worked = false;
+		for (Batch& b : batches)
+		{
+			uint32 generation = generationOf (b.cursor.load (std::memory_order_acquire));
+			while (claimAndRun (b, generation))
+				worked = true;
+		}
+		if (worked)
+			continue;
+
+		int32 spin = 0;
+		while (posted.load (std::memory_order_acquire) == seen)
+		{
+			if (++spin < kSpinCount)
+			{
+				cpuRelax ();
+				continue;
+			}
+			sleepers.fetch_add (1, std::memory_order_seq_cst);
+			{
+				std::unique_lock<std::mutex> lock (sleepMutex);
+				wake.wait_for (lock, kSleepTimeout, [&] {
+					return quit.load () || posted.load (std::memory_order_acquire) != seen;
+				});
+			}
+			sleepers.fetch_sub (1, std::memory_order_relaxed);
+			if (quit.load ())
+				return;
+			spin = kSpinCount;	//timed out: sleep again right away instead of another spin
+		}
+	}
+}
+
+}}} // namespaces
@@ -0,0 +1,91 @@
+/*
+ *  BKmdaPianoRenderPool.h
+ *  mda-vst3
+ *
+ *  声部并行渲染用的工作线程池，进程内所有实例共享一个（引用计数，和 SampleCache 一样）：
+ *  多实例宿主里工作线程总数不随实例数增加，也不会有好几组线程在同一批核上空转。线程不绑定 CPU，交给调度器。
+ *  第一次 run () 时记下调用线程（音频线程）的调度策略和优先级，工作线程换成同样的优先级，
+ *  音频线程等待的任务不会因为工作线程优先级低被长时间挂起（优先级反转）。
+ *
+ *  run () 在音频线程调用，可以有多个音频线程同时调用：每次 run () 占用一个批次槽，
+ *  任务序号和代数打包在槽里的 64 位原子变量里，工作线程和调用线程用 CAS 领取任务，没有锁，也不分配内存。
+ *  调用线程自己也领任务，工作线程睡着或被抢占时只是变慢，结果不受影响；槽用完时调用线程自己做完全部任务。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+class RenderPool
+{
+public:
+	typedef void (*JobFunc) (void* context, int32 job);
+
+	enum { kMaxWorkers = 16, kMaxJobs = 0xFFFF, kMaxBatches = 32 };
+
+	// 非音频线程调用：工作线程数取所有实例要求的最大值（不含调用 run () 的线程），用完调用 release ()
+	static RenderPool* acquire (int32 numWorkers);
+	void release ();
+
+	int32 getNumWorkers () const { return numWorkers.load (std::memory_order_relaxed); }
+
+	// 音频线程调用：执行 func (context, 0 .. numJobs-1)，全部完成后返回。
+	// 每个任务只执行一次，但由哪个线程执行不确定，任务之间不能写同一块内存。
+	void run (JobFunc func, void* context, int32 numJobs);
+
+private:
+	RenderPool ();
+	~RenderPool ();
+	RenderPool (const RenderPool&) = delete;
+	RenderPool& operator= (const RenderPool&) = delete;
+
+	struct alignas (64) Batch	//one run () call in flight
+	{
+		//高 32 位：代数（每次 run () 加一），中 16 位：任务数，低 16 位：下一个要领取的任务。
+		//三者放在同一个原子变量里，上一轮迟到的线程 CAS 一定失败，不会领到这一轮的任务
+		std::atomic<uint64> cursor;
+		std::atomic<int32> doneJobs;
+		std::atomic<bool> busy;	//taken by a run () call
+		JobFunc func;	//只在发布新的 cursor 之前写，领到任务的线程才读
+		void* context;
+	};
+
+	void addWorkers (int32 count);
+	void stop ();
+	void workerLoop ();
+	bool claimAndRun (Batch& batch, uint32 generation);
+	static uint32 generationOf (uint64 c) { return (uint32)(c >> 32); }
+	void recordPriority ();
+	void applyPriority ();
+
+	int32 refCount;	//registry mutex
+	std::vector<std::thread> threads;	//registry mutex
+	std::atomic<int32> numWorkers;
+
+	Batch batches[kMaxBatches];
+	alignas (64) std::atomic<uint32> posted;	//bumped by every run (), idle workers watch it
+	alignas (64) std::atomic<int32> sleepers;
+	std::atomic<bool> quit;
+
+	std::atomic<bool> priorityTaken;	//first run () records its thread's priority
+	std::atomic<uint32> priorityVersion;	//0 = not recorded yet
+	int32 schedPolicy;	//written once before priorityVersion is published
+	int32 schedPriority;
+
+	std::mutex sleepMutex;	//只有工作线程睡眠时用，音频线程不加锁
+	std::condition_variable wake;
+};
+
+}}} // namespaces
@@ -0,0 +1,329 @@
+/*
+ *  BKmdaPianoSampleBank.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoSampleBank.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef MDA_PIANO_SAMPLE_BANK_PATH
+#define MDA_PIANO_SAMPLE_BANK_PATH ""
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+static const char kSampleBankMagic[8] = {'M', 'D', 'A', 'P', 'B', 'A', 'N', 'K'};
+
+static std::mutex& registryMutex ()
+{
+	static std::mutex m;
+	return m;
+}
+
+static std::map<std::string, SampleBank*>& registry ()
+{
+	static std::map<std::string, SampleBank*> banks;
+	return banks;
+}
+
+static bool setError (std::string* error, const std::string& message)
+{
+	if (error) *error = message;
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+SampleBank::SampleBank ()
+: refCount (0)
+, samples (nullptr)
+, numSamples (0)
+, sampleRate (0)
+, keygroups (nullptr)
+, numKeygroups (0)
+, checksum (0)
+, mapping (nullptr)
+, mappingSize (0)
+#if defined (_WIN32)
+, fileHandle (nullptr)
+, mappingHandle (nullptr)
+#endif
+{
+}
+
+//-----------------------------------------------------------------------------
+SampleBank::~SampleBank ()
+{
+	unmap ();
+}
+
+//-----------------------------------------------------------------------------
+const char* SampleBank::getDefaultPath ()
+{
+	const char* path = getenv ("MDA_PIANO_SAMPLE_BANK");
+	if (path && *path)
+		return path;
+	return *MDA_PIANO_SAMPLE_BANK_PATH ? MDA_PIANO_SAMPLE_BANK_PATH : nullptr;
+}
+
+//-----------------------------------------------------------------------------
+SampleBank* SampleBank::acquire (const char* path, std::string* error)
+{
+	std::lock_guard<std::mutex> lock (registryMutex ());
+	auto it = registry ().find (path);
+	if (it != registry ().end ())
+	{
+		it->second->refCount++;
+		return it->second;
+	}
+
+	SampleBank* bank = new SampleBank;
+	if (!bank->map (path, error))
+	{
+		delete bank;
+		return nullptr;
+	}
+	bank->key = path;
+	bank->refCount = 1;
+	registry ()[bank->key] = bank;
+	return bank;
+}
+
+//-----------------------------------------------------------------------------
+SampleBank* SampleBank::acquireBuiltin (const short* data, uint32 count, uint32 rate,
+                                        const SampleBankKeygroup* groups, int32 numGroups)
+{
+	std::lock_guard<std::mutex> lock (registryMutex ());
+	static const char* kBuiltinKey = "<builtin>";
+	auto it = registry ().find (kBuiltinKey);
+	if (it != registry ().end ())
+	{
+		it->second->refCount++;
+		return it->second;
+	}
+
+	SampleBank* bank = new SampleBank;
+	bank->samples = data;
+	bank->numSamples = count;
+	bank->sampleRate = rate;
+	bank->keygroups = groups;
+	bank->numKeygroups = numGroups;
+	bank->updateChecksum ();
+	bank->key = kBuiltinKey;
+	bank->refCount = 1;
+	registry ()[bank->key] = bank;
+	return bank;
+}
+
+//-----------------------------------------------------------------------------
+void SampleBank::release ()
+{
+	std::lock_guard<std::mutex> lock (registryMutex ());
+	if (--refCount > 0)
+		return;
+	registry ().erase (key);
+	delete this;
+}
+
+//-----------------------------------------------------------------------------
+bool SampleBank::validate (const SampleBankKeygroup* groups, int32 numGroups, uint32 count, std::string* error)
+{
+	if (numGroups < 1 || numGroups > kSampleBankMaxKeygroups)
+		return setError (error, "keygroup count out of range");
+	for (int32 k = 0; k < numGroups; k++)
+	{
+		const SampleBankKeygroup& g = groups[k];
+		char name[32];
+		snprintf (name, sizeof (name), "keygroup %d: ", k);
+		if (g.pos < 0 || g.pos >= g.end || (uint32)g.end + 1 >= count)
+			return setError (error, std::string (name) + "sample range outside the bank");
+		if (g.loop <= 0 || g.loop > g.end - g.pos)
+			return setError (error, std::string (name) + "bad loop length");
+		if (k > 0 && g.high < groups[k - 1].high)
+			return setError (error, std::string (name) + "keygroups must be sorted by high note");
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool SampleBank::map (const char* path, std::string* error)
+{
+	const uint8* base = nullptr;
+	uint64 size = 0;
+
+#if defined (_WIN32)
+	HANDLE file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return setError (error, std::string ("cannot open ") + path);
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx (file, &fileSize);
+	HANDLE view = CreateFileMappingA (file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (view)
+		base = (const uint8*)MapViewOfFile (view, FILE_MAP_READ, 0, 0, 0);
+	fileHandle = file;
+	mappingHandle = view;
+	size = (uint64)fileSize.QuadPart;
+#else
+	int fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return setError (error, std::string ("cannot open ") + path);
+	struct stat st;
+	if (fstat (fd, &st) == 0 && st.st_size > 0)
+	{
+		size = (uint64)st.st_size;
+		void* p = mmap (nullptr, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+		base = p == MAP_FAILED ? nullptr : (const uint8*)p;
+	}
+	close (fd);	//映射建立后文件描述符就不需要了
+#endif
+
+	mapping = (void*)base;
+	mappingSize = size;
+	if (!base)
+	{
+		unmap ();
+		return setError (error, std::string ("cannot map ") + path);
+	}
+
+	//只读文件头和键组表，采样数据等声部用到时再缺页读入
+	SampleBankHeader header;
+	if (size < sizeof (header))
+	{
+		unmap ();
+		return setError (error, std::string (path) + ": file too small");
+	}
+	memcpy (&header, base, sizeof (header));
+
+	std::string problem;
+	if (memcmp (header.magic, kSampleBankMagic, sizeof (kSampleBankMagic)) != 0)
+		problem = "not a sample bank";
+	else if (header.version != kSampleBankVersion)
+		problem = "unsupported bank version " + std::to_string (header.version);
+	else if (header.headerSize < sizeof (header) || header.sampleFormat != kSampleFormatInt16 || header.sampleRate == 0)
+		problem = "unsupported bank header";
+	else if (header.numKeygroups < 1 || header.numKeygroups > kSampleBankMaxKeygroups
+	         || header.keygroupOffset < header.headerSize || header.keygroupOffset % 4 != 0
+	         || (uint64)header.keygroupOffset + header.numKeygroups * sizeof (SampleBankKeygroup) > size)
+		problem = "bad keygroup table";
+	//先确认 sampleOffset 在文件内，再用剩下的字节数限制 numSamples：相加的写法在 sampleOffset 很大时会溢出回绕
+	else if (header.sampleOffset % kSampleBankAlignment != 0 || header.numSamples > 0xFFFFFFFFu
+	         || header.sampleOffset > size
+	         || header.numSamples > (size - header.sampleOffset) / sizeof (short))
+		problem = "bad sample data range";
+	else
+		validate ((const SampleBankKeygroup*)(base + header.keygroupOffset), (int32)header.numKeygroups,
+		          (uint32)header.numSamples, &problem);
+	if (!problem.empty ())
+	{
+		unmap ();
+		return setError (error, std::string (path) + ": " + problem);
+	}
+
+	keygroups = (const SampleBankKeygroup*)(base + header.keygroupOffset);
+	numKeygroups = (int32)header.numKeygroups;
+	samples = (const short*)(base + header.sampleOffset);
+	numSamples = (uint32)header.numSamples;
+	sampleRate = header.sampleRate;
+	updateChecksum ();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void SampleBank::updateChecksum ()
+{
+	//trace 用它确认重放时用的是同一个音色库；只算文件头里的长度、采样率和键组表，不读采样页
+	uint32 h = 2166136261u;
+	auto add = [&h] (const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++)
+			h = (h ^ ((const uint8*)data)[i]) * 16777619u;
+	};
+	add (&numSamples, sizeof (numSamples));
+	add (&sampleRate, sizeof (sampleRate));
+	add (&numKeygroups, sizeof (numKeygroups));
+	add (keygroups, numKeygroups * sizeof (SampleBankKeygroup));
+	checksum = h;
+}
+
+//-----------------------------------------------------------------------------
+void SampleBank::unmap ()
+{
+#if defined (_WIN32)
+	if (mapping) UnmapViewOfFile (mapping);
+	if (mappingHandle) CloseHandle ((HANDLE)mappingHandle);
+	if (fileHandle && fileHandle != INVALID_HANDLE_VALUE) CloseHandle ((HANDLE)fileHandle);
+	fileHandle = mappingHandle = nullptr;
+#else
+	if (mapping)
+		munmap (mapping, (size_t)mappingSize);
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+void SampleBank::prefetch ()
+{
+	if (!mapping)
+		return;	//内置音色库在可执行文件里，由加载器负责
+#if defined (_WIN32)
+	//逐页读一个字节把页面调进来（PrefetchVirtualMemory 需要 Windows 8）
+	const volatile uint8* p = (const volatile uint8*)mapping;
+	for (uint64 i = 0; i < mappingSize; i += kSampleBankAlignment)
+		(void)p[i];
+#else
+	madvise (mapping, (size_t)mappingSize, MADV_WILLNEED);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+bool SampleBank::write (const char* path, const short* data, uint32 count, uint32 rate,
+                        const SampleBankKeygroup* groups, int32 numGroups, std::string* error)
+{
+	if (!validate (groups, numGroups, count, error))
+		return false;
+
+	SampleBankHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, kSampleBankMagic, sizeof (header.magic));
+	header.version = kSampleBankVersion;
+	header.headerSize = sizeof (header);
+	header.numKeygroups = (uint32)numGroups;
+	header.keygroupOffset = sizeof (header);
+	header.sampleRate = rate;
+	header.sampleFormat = kSampleFormatInt16;
+	uint64 tableEnd = header.keygroupOffset + numGroups * sizeof (SampleBankKeygroup);
+	header.sampleOffset = (tableEnd + kSampleBankAlignment - 1) / kSampleBankAlignment * kSampleBankAlignment;
+	header.numSamples = count;
+
+	FILE* file = fopen (path, "wb");
+	if (!file)
+		return setError (error, std::string ("cannot write ") + path);
+	std::vector<uint8> padding ((size_t)(header.sampleOffset - tableEnd), 0);
+	fwrite (&header, sizeof (header), 1, file);
+	fwrite (groups, sizeof (SampleBankKeygroup), numGroups, file);
+	fwrite (padding.data (), 1, padding.size (), file);
+	fwrite (data, sizeof (short), count, file);
+	bool ok = ferror (file) == 0;
+	ok = fclose (file) == 0 && ok;
+	return ok ? true : setError (error, std::string ("error writing ") + path);
+}
+
+}}} // namespaces
@@ -0,0 +1,119 @@
+/*
+ *  BKmdaPianoSampleBank.h
+ *  mda-vst3
+ *
+ *  外部音色库：文件头 + 键组表 + 按页对齐的 16 位 PCM，只读 mmap 后整个进程共享一份映射，
+ *  多个进程之间通过页缓存共享。SampleCache 在 initialize 时从映射里读一遍生成声部用的缓存，
+ *  之后音频线程不再访问映射。
+ *  没有指定外部音色库或加载失败时，用编译进来的 pianoData 作为内置音色库。
+ *
+ *  文件格式（小端）：
+ *    SampleBankHeader                              64 字节
+ *    SampleBankKeygroup[numKeygroups]              keygroupOffset 处
+ *    int16 samples[numSamples]                     sampleOffset 处，按 kSampleBankAlignment 对齐
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <string>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+enum {
+	kSampleBankVersion = 1,
+	kSampleBankAlignment = 4096,
+	kSampleBankMaxKeygroups = 256,	//PianoProcessor's note -> keygroup table holds uint8 indices
+	kSampleFormatInt16 = 1
+};
+
+struct SampleBankHeader
+{
+	char magic[8];	//"MDAPBANK"
+	uint32 version;
+	uint32 headerSize;
+	uint32 numKeygroups;
+	uint32 keygroupOffset;
+	uint32 sampleRate;	//rate the PCM was recorded at
+	uint32 sampleFormat;
+	uint64 sampleOffset;
+	uint64 numSamples;
+	uint32 reserved[4];
+};
+static_assert (sizeof (SampleBankHeader) == 64, "bank header layout");
+
+struct SampleBankKeygroup	//same fields as PianoProcessor::KGRP
+{
+	int32 root;	//MIDI root note
+	int32 high;	//highest note
+	int32 pos;
+	int32 end;
+	int32 loop;
+};
+static_assert (sizeof (SampleBankKeygroup) == 20, "bank keygroup layout");
+
+//-----------------------------------------------------------------------------
+class SampleBank
+{
+public:
+	// 非音频线程调用。同一路径在进程内只映射一次，用完调用 release ()
+	static SampleBank* acquire (const char* path, std::string* error = nullptr);
+	static SampleBank* acquireBuiltin (const short* samples, uint32 numSamples, uint32 sampleRate,
+	                                   const SampleBankKeygroup* keygroups, int32 numKeygroups);
+	void release ();
+
+	// 环境变量 MDA_PIANO_SAMPLE_BANK，其次是编译时的 MDA_PIANO_SAMPLE_BANK_PATH，都没有则返回 nullptr
+	static const char* getDefaultPath ();
+
+	// 把采样页预读进内存，生成缓存时顺序读一遍不用逐页等缺页
+	void prefetch ();
+
+	const short* getSamples () const { return samples; }
+	uint32 getNumSamples () const { return numSamples; }
+	uint32 getSampleRate () const { return sampleRate; }
+	const SampleBankKeygroup* getKeygroups () const { return keygroups; }
+	int32 getNumKeygroups () const { return numKeygroups; }
+	uint32 getChecksum () const { return checksum; }	//FNV-1a of numSamples, sampleRate and the keygroup table
+	bool isMapped () const { return mapping != nullptr; }
+
+	// 写音色库文件（bank writer 工具用）
+	static bool write (const char* path, const short* samples, uint32 numSamples, uint32 sampleRate,
+	                   const SampleBankKeygroup* keygroups, int32 numKeygroups, std::string* error = nullptr);
+
+	// 键组是否能安全地被声部读取：插值会读到 waves[end + 1]
+	static bool validate (const SampleBankKeygroup* keygroups, int32 numKeygroups, uint32 numSamples, std::string* error);
+
+private:
+	SampleBank ();
+	~SampleBank ();
+	SampleBank (const SampleBank&) = delete;
+	SampleBank& operator= (const SampleBank&) = delete;
+
+	bool map (const char* path, std::string* error);
+	void unmap ();
+	void updateChecksum ();
+
+	std::string key;
+	int32 refCount;
+
+	const short* samples;
+	uint32 numSamples;
+	uint32 sampleRate;
+	const SampleBankKeygroup* keygroups;
+	int32 numKeygroups;
+	uint32 checksum;
+
+	void* mapping;
+	uint64 mappingSize;
+#if defined (_WIN32)
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+};
+
+}}} // namespaces
@@ -0,0 +1,99 @@
+/*
+ *  BKmdaPianoSampleCache.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoSampleCache.h"
+#include "BKmdaPianoSampleMips.h"
+
+#include <map>
+#include <mutex>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+static std::mutex& cacheMutex ()
+{
+	static std::mutex m;
+	return m;
+}
+
+static std::map<const SampleBank*, SampleCache*>& caches ()
+{
+	static std::map<const SampleBank*, SampleCache*> c;
+	return c;
+}
+
+//-----------------------------------------------------------------------------
+SampleCache* SampleCache::acquire (SampleBank& bank)
+{
+	//调用者在释放 bank 之前先释放缓存，所以用 bank 的地址做键是安全的
+	std::lock_guard<std::mutex> lock (cacheMutex ());
+	auto it = caches ().find (&bank);
+	if (it != caches ().end ())
+	{
+		it->second->refCount++;
+		return it->second;
+	}
+
+	SampleCache* cache = new SampleCache;
+	cache->build (bank);
+	cache->source = &bank;
+	cache->refCount = 1;
+	caches ()[&bank] = cache;
+	return cache;
+}
+
+//-----------------------------------------------------------------------------
+void SampleCache::release ()
+{
+	std::lock_guard<std::mutex> lock (cacheMutex ());
+	if (--refCount > 0)
+		return;
+	caches ().erase (source);
+	delete this;
+}
+
+//-----------------------------------------------------------------------------
+void SampleCache::build (SampleBank& bank)
+{
+	//音色库和各级降采样副本一起展开（SampleMips::build 顺序读整个映射之前先预读）
+	SampleMips mips;
+	mips.build (bank, MDA_PIANO_MIP_LEVELS);
+	const short* waves = mips.samples.data ();
+	const SampleBankKeygroup* groups = mips.keygroups.data ();
+	int32 numGroups = (int32)mips.keygroups.size ();
+	numBaseKeygroups = mips.numBaseKeygroups;
+	numMipLevels = mips.numLevels;
+
+	size_t total = 2;	//位置 0 留给空声部（VoiceLanes::clear），读 waves[0..1] 总是安全的
+	for (int32 k = 0; k < numGroups; k++)
+		total += (size_t)(groups[k].end - groups[k].pos + 1 + kLoopGuard);
+	samples.resize (total);
+	keygroups.resize (numGroups);
+	samples[0] = samples[1] = 0;
+
+	uint32 offset = 2;
+	for (int32 k = 0; k < numGroups; k++)
+	{
+		const SampleBankKeygroup& g = groups[k];
+		for (int32 p = g.pos; p <= g.end + kLoopGuard; p++)
+		{
+			//展开的位置取回绕以后的样本，与原来 if (pos > end) pos -= loop 之后读到的相同
+			int32 q = p;
+			while (q > g.end) q -= g.loop;
+			samples[offset + (p - g.pos)] = pack (waves[q], waves[q + 1]);
+		}
+
+		SampleBankKeygroup& c = keygroups[k];
+		c = g;
+		c.pos = (int32)offset;
+		c.end = (int32)offset + (g.end - g.pos);
+		offset += (uint32)(g.end - g.pos + 1 + kLoopGuard);
+	}
+}
+
+}}} // namespaces
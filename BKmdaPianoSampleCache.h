@@ -0,0 +1,60 @@
+/*
+ *  BKmdaPianoSampleCache.h
+ *  mda-vst3
+ *
+ *  声部内核读的采样缓存，由音色库一次性生成，进程内所有实例共享（引用计数）。
+ *  每个位置是一个 32 位字：低 16 位 waves[p]，高 16 位 waves[p+1]，一次读取就拿到插值需要的两个点。
+ *  每个键组在 end 之后展开 kLoopGuard 个保护位置（内容等于回绕后的位置），
+ *  内核可以先算出多少帧之内不会越过保护区，中间不做逐帧的 if (pos > end) pos -= loop，
+ *  段末再统一回绕。回绕前后读到的值与原来逐帧回绕完全相同，输出逐位一致。
+ *  音色库的键组之后是各级降采样副本的键组（SampleMips），同样展开。
+ *
+ */
+
+#pragma once
+
+#include "BKmdaPianoSampleBank.h"
+#include "BKmdaPianoVoiceKernel.h"
+
+#include <vector>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+class SampleCache
+{
+public:
+	enum { kLoopGuard = kSampleGuard };
+
+	// 非音频线程调用
+	static SampleCache* acquire (SampleBank& bank);
+	void release ();
+
+	const uint32* getSamples () const { return samples.data (); }
+	// 与音色库相同的键组，pos/end 换成缓存里的位置，root/high/loop 不变；
+	// 第 level 级副本的键组 k 在 [level * getNumKeygroups () + k]
+	const SampleBankKeygroup* getKeygroups () const { return keygroups.data (); }
+	int32 getNumKeygroups () const { return numBaseKeygroups; }
+	int32 getNumMipLevels () const { return numMipLevels; }	//including the bank itself
+	uint32 getSize () const { return (uint32)samples.size (); }
+
+	static uint32 pack (short a, short b) { return (uint32)(uint16)a | ((uint32)(uint16)b << 16); }
+
+private:
+	SampleCache () : refCount (0), source (nullptr), numBaseKeygroups (0), numMipLevels (1) {}
+	SampleCache (const SampleCache&) = delete;
+	SampleCache& operator= (const SampleCache&) = delete;
+
+	void build (SampleBank& bank);
+
+	int32 refCount;
+	const SampleBank* source;
+	std::vector<uint32> samples;
+	std::vector<SampleBankKeygroup> keygroups;
+	int32 numBaseKeygroups;
+	int32 numMipLevels;
+};
+
+}}} // namespaces
@@ -0,0 +1,125 @@
+/*
+ *  BKmdaPianoSampleMips.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoSampleMips.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+// 加窗（Blackman）sinc 低通，按 1/kPhases 个采样的间隔查表再线性插值，采样点可以落在任意小数位置
+class MipFilter
+{
+public:
+	enum { kPhases = 256 };
+
+	MipFilter (int32 factor)
+	: half (SampleMips::kTaps * factor)
+	{
+		const double pi = 3.14159265358979323846;
+		double fc = 0.45 / factor;	//cycles per bank sample
+		table.resize (half * kPhases + 2);
+		for (size_t i = 0; i < table.size (); i++)
+		{
+			double d = (double)i / kPhases;
+			double w = d < half ? 0.42 + 0.5 * cos (pi * d / half) + 0.08 * cos (2.0 * pi * d / half) : 0.0;
+			table[i] = w * (i == 0 ? 2.0 * fc : sin (2.0 * pi * fc * d) / (pi * d));
+		}
+	}
+
+	int32 getHalf () const { return half; }
+
+	double operator() (double d) const
+	{
+		d = fabs (d) * kPhases;
+		int32 i = (int32)d;
+		return table[i] + (d - i) * (table[i + 1] - table[i]);
+	}
+
+private:
+	int32 half;
+	std::vector<double> table;
+};
+
+//-----------------------------------------------------------------------------
+// 键组 g 在位置 t 的带限值：end 之后按 loop 回绕（和声部读到的一样），pos 之前当作 0
+static double filterAt (const short* waves, const SampleBankKeygroup& g, const MipFilter& filter, double t)
+{
+	int32 half = filter.getHalf ();
+	int32 first = (int32)ceil (t) - half, last = (int32)floor (t) + half;
+	double sum = 0.0;
+	for (int32 n = first; n <= last; n++)
+	{
+		int32 q = n;
+		while (q > g.end) q -= g.loop;
+		if (q >= g.pos)
+			sum += waves[q] * filter (t - n);
+	}
+	return sum;
+}
+
+//-----------------------------------------------------------------------------
+static short toSample (double value)
+{
+	value = floor (value + 0.5);
+	return (short)std::min (32767.0, std::max (-32768.0, value));
+}
+
+//-----------------------------------------------------------------------------
+void SampleMips::build (SampleBank& bank, int32 levels)
+{
+	bank.prefetch ();
+	const short* waves = bank.getSamples ();
+	numBaseKeygroups = bank.getNumKeygroups ();
+	numLevels = 1 + std::max (0, levels);
+	samples.assign (waves, waves + bank.getNumSamples ());
+	keygroups.assign (bank.getKeygroups (), bank.getKeygroups () + numBaseKeygroups);
+
+	for (int32 level = 1; level < numLevels; level++)
+	{
+		int32 factor = 1 << level;
+		MipFilter filter (factor);
+		for (int32 k = 0; k < numBaseKeygroups; k++)
+		{
+			//采样点都落在 loopStart + i * factor 上，声部的 delta >> level 就是准确的音高；
+			//循环前补齐到整数个点（最前面一点可能早于 pos，按 0 计），循环段取最接近的整数个点
+			SampleBankKeygroup g = keygroups[k];
+			int32 loopStart = std::max (g.pos, g.end - g.loop + 1);
+			int32 length = g.end + 1 - loopStart;
+			int32 pre = (loopStart - g.pos + factor - 1) / factor;
+			int32 loop = std::max (1, (length + factor / 2) / factor);
+
+			//循环段比原来长或短了 shift 个原始采样，回绕处会错开这么多；在末尾 fade 个点里
+			//逐渐换成 t + shift 处的值，读到 end + 1 时正好接上循环起点
+			int32 shift = length - loop * factor;
+			int32 fade = std::min (loop, (int32)kTaps);
+
+			SampleBankKeygroup m = g;
+			m.pos = (int32)samples.size ();
+			m.end = m.pos + pre + loop - 1;
+			m.loop = loop;
+			for (int32 n = 0; n <= pre + loop; n++)
+			{
+				int32 i = n - pre;
+				double t = loopStart + (double)i * factor;
+				double value = filterAt (waves, g, filter, t);
+				if (shift != 0 && i > loop - fade)
+				{
+					double w = (double)(i - (loop - fade)) / fade;
+					value += w * (filterAt (waves, g, filter, t + shift) - value);
+				}
+				samples.push_back (toSample (value));
+			}
+			keygroups.push_back (m);
+		}
+	}
+}
+
+}}} // namespaces
@@ -0,0 +1,48 @@
+/*
+ *  BKmdaPianoSampleMips.h
+ *  mda-vst3
+ *
+ *  按音高的 mipmap：每个键组在加载时生成 MDA_PIANO_MIP_LEVELS 个带限、逐级降采样一倍的副本。
+ *  高音区的声部 delta 很大（最高的键组从 93 一直拉到键盘顶端，size/sizevel 还会再往上推），
+ *  读原始采样时会混叠，而且每个输出采样跨过好几个缓存行；换成降采样的副本后 delta 回到 1 附近。
+ *
+ *  每一级用加窗 sinc 低通（截止在降采样后奈奎斯特的 0.9）在新的采样点上求值，读到 end 之后按 loop 回绕，
+ *  所以循环段也是带限的、首尾连续。所有采样点的间隔都正好是 2^level 个原始采样，音高和原始采样一致；
+ *  循环长度除不尽时取最接近的整数个点，差出的不到半个点在循环末尾交叉淡入接上。
+ *  SampleCache 和 CompressedBank 都从这里的采样和键组生成。
+ *
+ *  默认不生成副本。内置音色库是 22.05 kHz，44.1 kHz 下 note 108 以内（包括 size/sizevel 最多 +16 的偏移）delta 都不超过约 1.33，
+ *  1/2 一级（delta > √2）要到 note 111 左右才用到，1/4 一级要到 note 123 左右，88.2 kHz 以上一级都用不到；
+ *  而 1/2 一级会让共享缓存从约 2.6 MB 涨到 3.9 MB。44.1/48 kHz 录制的外部音色库高音区 delta 才会明显大于 1，这时再打开。
+ *
+ */
+
+#pragma once
+
+#include "BKmdaPianoSampleBank.h"
+
+#include <vector>
+
+#ifndef MDA_PIANO_MIP_LEVELS
+#define MDA_PIANO_MIP_LEVELS 0	//band-limited copies at 1/2, 1/4... of the bank rate; 0 = play the bank only
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+struct SampleMips
+{
+	enum { kTaps = 16 };	//filter half-length in output samples of each level
+
+	// 非音频线程：level 0 是音色库本身（位置不变），之后每一级 numBaseKeygroups 个键组接在后面
+	void build (SampleBank& bank, int32 levels);
+
+	std::vector<short> samples;	//bank samples followed by the copies
+	std::vector<SampleBankKeygroup> keygroups;	//[level * numBaseKeygroups + k]
+	int32 numBaseKeygroups;
+	int32 numLevels;	//including the bank itself
+};
+
+}}} // namespaces
@@ -0,0 +1,108 @@
+/*
+ *  BKmdaPianoSpscRing.h
+ *  mda-vst3
+ *
+ *  单生产者/单消费者环形缓冲（无锁，不分配）。Telemetry（每块的 BlockStats）、LiveEventQueue（live 事件）
+ *  和 TraceRecorder（变长记录的字节流）共用：读写位置是只增不减的 32 位计数，各占一条缓存行，
+ *  下标取 & (容量 - 1)。写满时由调用者决定丢弃和计数，生产者和消费者都不等待。
+ *
+ *  生产者：push 放一个元素；或者 write 在未发布的位置上写任意多段（可以跨过环尾），再 publish 一次发布。
+ *  消费者：peek / pop 逐个处理，或 read 一次拷出多个。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+template <typename T>
+class SpscRing
+{
+public:
+	explicit SpscRing (uint32 capacity = 0) : writeIndex (0), readIndex (0) { allocate (capacity); }
+
+	// 非音频线程，生产者和消费者都还没用的时候：容量是 2 的幂，0 = 不分配；只分配一次，之后调用不再改变
+	void allocate (uint32 capacity)
+	{
+		if (items.empty () && capacity > 0)
+			items.assign (capacity, T ());
+	}
+	uint32 getCapacity () const { return (uint32)items.size (); }
+
+	// 生产者（唯一）
+	uint32 getFree () const
+	{
+		return getCapacity () - (writeIndex.load (std::memory_order_relaxed) - readIndex.load (std::memory_order_acquire));
+	}
+
+	bool push (const T& item)
+	{
+		if (getFree () == 0)
+			return false;
+		uint32 w = writeIndex.load (std::memory_order_relaxed);
+		items[w & (getCapacity () - 1)] = item;
+		writeIndex.store (w + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 从第一个未发布的位置往后 offset 个元素开始写 count 个；调用者先用 getFree () 确认放得下
+	void write (uint32 offset, const T* data, uint32 count)
+	{
+		//跨过环尾时分两段拷贝
+		uint32 at = (writeIndex.load (std::memory_order_relaxed) + offset) & (getCapacity () - 1);
+		uint32 first = std::min (count, getCapacity () - at);
+		std::copy (data, data + first, items.data () + at);
+		std::copy (data + first, data + count, items.data ());
+	}
+
+	void publish (uint32 count)
+	{
+		writeIndex.store (writeIndex.load (std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+	// 消费者（唯一）
+	const T* peek () const
+	{
+		uint32 r = readIndex.load (std::memory_order_relaxed);
+		if (writeIndex.load (std::memory_order_acquire) == r)
+			return nullptr;
+		return &items[r & (getCapacity () - 1)];
+	}
+
+	void pop ()
+	{
+		readIndex.store (readIndex.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	uint32 read (T* dest, uint32 maxCount)
+	{
+		uint32 r = readIndex.load (std::memory_order_relaxed);
+		uint32 available = writeIndex.load (std::memory_order_acquire) - r;
+		uint32 count = std::min (available, maxCount);
+		uint32 at = r & (getCapacity () - 1);
+		uint32 first = std::min (count, getCapacity () - at);
+		std::copy (items.data () + at, items.data () + at + first, dest);
+		std::copy (items.data (), items.data () + (count - first), dest + first);
+		readIndex.store (r + count, std::memory_order_release);
+		return count;
+	}
+
+private:
+	SpscRing (const SpscRing&) = delete;
+	SpscRing& operator= (const SpscRing&) = delete;
+
+	alignas (64) std::atomic<uint32> writeIndex;	//producer cache line
+	alignas (64) std::atomic<uint32> readIndex;	//consumer cache line
+	std::vector<T> items;
+};
+
+}}} // namespaces
@@ -0,0 +1,165 @@
+/*
+ *  BKmdaPianoTelemetry.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoTelemetry.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+Telemetry::Telemetry ()
+: enabled (false)
+, dropped (0)
+, ring (kRingSize)
+{
+}
+
+//-----------------------------------------------------------------------------
+bool Telemetry::publish (const BlockStats& stats)
+{
+	if (ring.push (stats))
+		return true;
+	dropped.fetch_add (1, std::memory_order_relaxed);
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+int32 Telemetry::read (BlockStats* dest, int32 maxCount)
+{
+	return (int32)ring.read (dest, (uint32)maxCount);
+}
+
+//-----------------------------------------------------------------------------
+void Histogram::clear ()
+{
+	memset (buckets, 0, sizeof (buckets));
+	count = maxValue = 0;
+}
+
+//-----------------------------------------------------------------------------
+int32 Histogram::bucketOf (uint64 value)
+{
+	if (value < kLinear)
+		return (int32)value;
+	int32 exponent = 63;
+	while (!(value >> exponent)) exponent--;	//exponent >= 4
+	int32 sub = (int32)(value >> (exponent - kSubBits)) & ((1 << kSubBits) - 1);
+	return kLinear + (exponent - 4) * (1 << kSubBits) + sub;
+}
+
+//-----------------------------------------------------------------------------
+uint64 Histogram::bucketTop (int32 bucket)
+{
+	if (bucket < kLinear)
+		return (uint64)bucket;
+	int32 exponent = 4 + (bucket - kLinear) / (1 << kSubBits);
+	int32 sub = (bucket - kLinear) % (1 << kSubBits);
+	uint64 step = (uint64)1 << (exponent - kSubBits);
+	return ((uint64)1 << exponent) + (uint64)(sub + 1) * step - 1;
+}
+
+//-----------------------------------------------------------------------------
+void Histogram::add (uint64 value)
+{
+	buckets[bucketOf (value)]++;
+	count++;
+	if (value > maxValue) maxValue = value;
+}
+
+//-----------------------------------------------------------------------------
+uint64 Histogram::percentile (double p) const
+{
+	if (count == 0)
+		return 0;
+	uint64 rank = (uint64)(p / 100.0 * (double)count + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > count) rank = count;
+	uint64 seen = 0;
+	for (int32 b = 0; b < kBuckets; b++)
+	{
+		seen += buckets[b];
+		if (seen >= rank)
+		{
+			uint64 top = bucketTop (b);
+			return top < maxValue ? top : maxValue;
+		}
+	}
+	return maxValue;
+}
+
+//-----------------------------------------------------------------------------
+void TelemetrySummary::clear ()
+{
+	renderNs.clear ();  eventNs.clear ();  voiceNs.clear ();  stereoNs.clear ();
+	activeVoices.clear ();  events.clear ();
+	blocks = frames = 0;
+	noteOns = steals = missedNoteOffs = 0;
+	maxActiveVoices = 0;
+}
+
+//-----------------------------------------------------------------------------
+void TelemetrySummary::add (const BlockStats& s)
+{
+	renderNs.add (s.renderNs);
+	eventNs.add (s.eventNs);
+	voiceNs.add (s.voiceNs);
+	stereoNs.add (s.stereoNs);
+	activeVoices.add ((uint64)s.maxActiveVoices);
+	events.add ((uint64)s.events);
+	blocks++;
+	frames += (uint64)s.frames;
+	noteOns += (uint64)s.noteOns;
+	steals += (uint64)s.steals;
+	missedNoteOffs += (uint64)s.missedNoteOffs;
+	if (s.maxActiveVoices > maxActiveVoices) maxActiveVoices = s.maxActiveVoices;
+}
+
+//-----------------------------------------------------------------------------
+int32 TelemetrySummary::collect (Telemetry& telemetry)
+{
+	BlockStats batch[64];
+	int32 total = 0, n;
+	while ((n = telemetry.read (batch, 64)) > 0)
+	{
+		for (int32 i = 0; i < n; i++)
+			add (batch[i]);
+		total += n;
+	}
+	return total;
+}
+
+//-----------------------------------------------------------------------------
+std::string TelemetrySummary::format (uint64 dropped) const
+{
+	char line[160];
+	std::string text;
+	snprintf (line, sizeof (line), "blocks %llu, frames %llu, dropped %llu\n",
+		(unsigned long long)blocks, (unsigned long long)frames, (unsigned long long)dropped);
+	text += line;
+	snprintf (line, sizeof (line), "note-ons %llu, steals %llu, missed note-offs %llu, max voices %d\n",
+		(unsigned long long)noteOns, (unsigned long long)steals, (unsigned long long)missedNoteOffs, maxActiveVoices);
+	text += line;
+	snprintf (line, sizeof (line), "%-14s %10s %10s %10s\n", "", "p50", "p99", "max");
+	text += line;
+	const struct { const char* name; const Histogram* h; } rows[] = {
+		{"render ns", &renderNs}, {"events ns", &eventNs}, {"voices ns", &voiceNs}, {"stereo ns", &stereoNs},
+		{"active voices", &activeVoices}, {"events", &events},
+	};
+	for (const auto& row : rows)
+	{
+		snprintf (line, sizeof (line), "%-14s %10llu %10llu %10llu\n", row.name,
+			(unsigned long long)row.h->percentile (50.0), (unsigned long long)row.h->percentile (99.0),
+			(unsigned long long)row.h->getMax ());
+		text += line;
+	}
+	return text;
+}
+
+}}} // namespaces
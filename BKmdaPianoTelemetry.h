@@ -0,0 +1,119 @@
+/*
+ *  BKmdaPianoTelemetry.h
+ *  mda-vst3
+ *
+ *  每块的性能统计。音频线程把一块的 BlockStats 写进单生产者/单消费者环形缓冲（无锁、无分配），
+ *  读取线程（或离线渲染器在 process () 之间）取出后累加到 TelemetrySummary 的直方图里，
+ *  给出 p50/p99/max。读得太慢时环满，新的记录被丢弃并计数，音频线程从不等待。
+ *
+ */
+
+#pragma once
+
+#include "BKmdaPianoSpscRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+struct BlockStats
+{
+	uint64 block;		//processed block counter
+	int32 frames;
+	int32 maxActiveVoices;	//high-water mark inside the block
+	int32 events;		//note and pedal events applied
+	int32 noteOns;
+	int32 steals;		//note-ons that replaced a sounding voice
+	int32 missedNoteOffs;	//note-offs without a voice holding that noteID
+	uint32 renderNs;	//whole doProcessing
+	uint32 eventNs;		//noteEvent / sustainEvent
+	uint32 voiceNs;		//renderVoices
+	uint32 stereoNs;	//renderStereo
+};
+
+// 计时用单调时钟（纳秒）。rdtsc 需要校准频率，而且在不同核之间不一定同步，这里不用
+inline uint64 telemetryNow ()
+{
+	return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds> (
+		std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+//-----------------------------------------------------------------------------
+class Telemetry
+{
+public:
+	enum { kRingSize = 1024 };	//blocks buffered for the reader, power of 2
+
+	Telemetry ();
+
+	// 任意线程
+	void setEnabled (bool state) { enabled.store (state, std::memory_order_relaxed); }
+	bool isEnabled () const { return enabled.load (std::memory_order_relaxed); }
+	uint64 getDropped () const { return dropped.load (std::memory_order_relaxed); }
+
+	// 音频线程（唯一的生产者）：环满时丢弃并返回 false
+	bool publish (const BlockStats& stats);
+
+	// 读取线程（唯一的消费者）：取出最多 maxCount 条，返回条数
+	int32 read (BlockStats* dest, int32 maxCount);
+
+private:
+	std::atomic<bool> enabled;
+	std::atomic<uint64> dropped;
+	SpscRing<BlockStats> ring;
+};
+
+//-----------------------------------------------------------------------------
+// 对数分桶直方图：每个 2 的幂区间分 8 个桶，相对误差不超过 12.5%；最大值精确记录
+class Histogram
+{
+public:
+	enum { kSubBits = 3, kLinear = 16, kBuckets = kLinear + (64 - 4) * (1 << kSubBits) };
+
+	Histogram () { clear (); }
+
+	void clear ();
+	void add (uint64 value);
+	uint64 percentile (double p) const;	//p in 0..100, upper edge of the bucket (clamped to max)
+	uint64 getMax () const { return maxValue; }
+	uint64 getCount () const { return count; }
+
+private:
+	static int32 bucketOf (uint64 value);
+	static uint64 bucketTop (int32 bucket);
+
+	uint64 buckets[kBuckets];
+	uint64 count;
+	uint64 maxValue;
+};
+
+//-----------------------------------------------------------------------------
+// 读取端：从 Telemetry 取出所有记录并累加。只在一个线程上使用
+class TelemetrySummary
+{
+public:
+	TelemetrySummary () { clear (); }
+
+	void clear ();
+	int32 collect (Telemetry& telemetry);	//returns blocks read
+	void add (const BlockStats& stats);
+
+	// 直方图单位：时间为纳秒，其余为个数
+	Histogram renderNs, eventNs, voiceNs, stereoNs;
+	Histogram activeVoices, events;
+
+	uint64 blocks;
+	uint64 frames;
+	uint64 noteOns, steals, missedNoteOffs;
+	int32 maxActiveVoices;
+
+	// 多行文本报告：计数和各直方图的 p50/p99/max
+	std::string format (uint64 dropped = 0) const;
+};
+
+}}} // namespaces
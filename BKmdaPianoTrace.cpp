@@ -0,0 +1,79 @@
+/*
+ *  BKmdaPianoTrace.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoTrace.h"
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+TraceRecorder::TraceRecorder ()
+: enabled (false)
+, pending (0)
+, dropped (0)
+, bytes (0)
+{
+}
+
+//-----------------------------------------------------------------------------
+void TraceRecorder::setEnabled (bool state)
+{
+	//缓冲只分配一次，关闭后也不释放：音频线程可能还在写最后一条
+	if (state)
+		ring.allocate (kRingBytes);
+	enabled.store (state, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+bool TraceRecorder::begin (uint32 type, uint32 size)
+{
+	if (size > ring.getFree ())
+	{
+		dropped.fetch_add (1, std::memory_order_relaxed);
+		return false;
+	}
+	pending = 0;
+	TraceRecord header = {type, size};
+	put (&header, sizeof (header));
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void TraceRecorder::put (const void* data, uint32 size)
+{
+	ring.write (pending, (const uint8*)data, size);
+	pending += size;
+}
+
+//-----------------------------------------------------------------------------
+void TraceRecorder::commit ()
+{
+	bytes.fetch_add (pending, std::memory_order_relaxed);
+	ring.publish (pending);
+	pending = 0;
+}
+
+//-----------------------------------------------------------------------------
+int32 TraceRecorder::read (uint8* dest, int32 maxBytes)
+{
+	return (int32)ring.read (dest, (uint32)maxBytes);
+}
+
+//-----------------------------------------------------------------------------
+bool TraceRecorder::flush (FILE* file)
+{
+	uint8 buffer[16384];
+	int32 n;
+	while ((n = read (buffer, (int32)sizeof (buffer))) > 0)
+	{
+		if (fwrite (buffer, 1, (size_t)n, file) != (size_t)n)
+			return false;
+	}
+	return true;
+}
+
+}}} // namespaces
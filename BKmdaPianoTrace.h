@@ -0,0 +1,142 @@
+/*
+ *  BKmdaPianoTrace.h
+ *  mda-vst3
+ *
+ *  处理器输入的二进制记录，用来离线重现现场的问题（tools/BKmdaPianoReplay.cpp）。
+ *  随机失谐由音高决定，抢占和自适应复音取决于事件的先后和每块的耗时，所以要重现一段输出，
+ *  需要每块实际处理的音符事件和参数变化（合并宿主和 live 队列之后、已经换算成采样偏移的）、块长、
+ *  采样精度、输出总线，以及自适应复音在块尾给出的上限（参数队列满时提前生效的变化单独记下，重放时先于排队的生效）；setActive 时再记下采样率、各声部组合的参数，
+ *  以及编译选项（声部组合数、声部数、mip 级数）和音色库的标识，重放时不一致就拒绝。
+ *
+ *  音频线程把每条记录整条写进单生产者/单消费者字节环（无锁，不分配），放不下就整条丢弃并计数；
+ *  读取线程（或离线渲染器在 process () 之间）用 flush 写进文件。文件就是这些记录首尾相接，
+ *  按本机字节序，没有文件头：每次 setActive (true) 以 TraceStart 开始一段，之后每块一条 TraceBlock。
+ *
+ */
+
+#pragma once
+
+#include "BKmdaPianoSpscRing.h"
+#include "pluginterfaces/vst/vsttypes.h"
+
+#include <cstdio>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+enum {
+	kTraceMagic = 0x5450444D,	//"MDPT"
+	kTraceVersion = 3,
+	kTraceParams = 12	//PianoProcessor NPARAMS
+};
+
+//-----------------------------------------------------------------------------
+struct TraceRecord	//in front of every record
+{
+	enum Type { kStart = 1, kBlock = 2 };
+
+	uint32 type;
+	uint32 size;	//bytes including this header
+};
+
+//-----------------------------------------------------------------------------
+// setActive (true)：之后是 numParts 个 TracePart 和 numControls 个 TraceControl（停用时排队、setActive 时生效的变化）
+struct TraceStart
+{
+	uint32 magic;
+	uint32 version;
+	double sampleRate;
+	int32 maxSamplesPerBlock;
+	int32 symbolicSampleSize;
+	int32 numParts;
+	int32 numVoices;
+	int32 numMipLevels;
+	int32 renderThreads;
+	int32 compressedSamples;
+	int32 numControls;
+	uint32 bankSamples;	//sample bank the processor loaded (MDA_PIANO_SAMPLE_BANK or the built-in one)
+	uint32 bankSampleRate;
+	uint32 bankChecksum;	//SampleBank::getChecksum ()
+	uint32 reserved;
+};
+
+struct TracePart
+{
+	uint32 program;
+	uint32 reserved;
+	double params[kTraceParams];
+};
+
+//-----------------------------------------------------------------------------
+// 一块：之后是 numEvents 个 TraceNote、numEarlyControls 个 TraceControl（参数队列满时马上生效的，按生效的顺序）
+// 和 numControls 个 TraceControl（排在队列里、按 sampleOffset 生效的），都按处理的顺序
+struct TraceBlock
+{
+	uint64 block;	//block counter, a gap means records were dropped
+	int32 frames;
+	int32 symbolicSampleSize;
+	int32 numOutputs;
+	uint32 busMask;	//outputs a part rendered to on its own, the others were mixed into output 0
+	int32 voiceCap;	//adaptive polyphony cap after the block, -1 = off
+	uint32 renderNs;
+	int32 numEvents;
+	int32 numControls;
+	int32 numEarlyControls;	//applied before the queued ones, in this order
+	int32 lostControls;	//applied early but not recorded, the output is not exact after this block
+};
+
+struct TraceNote
+{
+	int32 sampleOffset;
+	int32 type;	//Event::kNoteOnEvent or kNoteOffEvent
+	int32 channel;
+	int32 pitch;
+	float velocity;
+	int32 noteId;
+};
+
+struct TraceControl
+{
+	int32 sampleOffset;
+	int32 part;
+	ParamID id;	//< kTraceParams, kPresetParam, kModWheelParam or kSustainParam
+	uint32 reserved;
+	ParamValue value;
+};
+
+//-----------------------------------------------------------------------------
+class TraceRecorder
+{
+public:
+	enum { kRingBytes = 1 << 22 };	//power of 2
+
+	TraceRecorder ();
+
+	// 非音频线程：打开时分配环形缓冲，从下一次 setActive (true) 开始记录；关闭立即生效
+	void setEnabled (bool state);
+	bool isEnabled () const { return enabled.load (std::memory_order_relaxed); }
+
+	// 音频线程（唯一的生产者），以及 setActive：begin 留出整条记录的位置，放不下时丢弃并返回 false；
+	// 之后 put 的总字节数必须等于 bytes（含 TraceRecord），commit 后读取端才看得到
+	bool begin (uint32 type, uint32 bytes);
+	void put (const void* data, uint32 bytes);
+	void commit ();
+
+	// 读取线程（唯一的消费者）
+	int32 read (uint8* dest, int32 maxBytes);
+	bool flush (FILE* file);	//everything available, false on a write error
+
+	// 任意线程
+	uint64 getDropped () const { return dropped.load (std::memory_order_relaxed); }	//records that did not fit
+	uint64 getBytes () const { return bytes.load (std::memory_order_relaxed); }	//committed so far
+
+private:
+	std::atomic<bool> enabled;
+	SpscRing<uint8> ring;	//allocated by the first setEnabled (true)
+	uint32 pending;	//bytes of the record being written, not yet published
+	std::atomic<uint64> dropped;
+	std::atomic<uint64> bytes;
+};
+
+}}} // namespaces
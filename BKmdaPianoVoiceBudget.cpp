@@ -0,0 +1,104 @@
+/*
+ *  BKmdaPianoVoiceBudget.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoVoiceBudget.h"
+
+#include <algorithm>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+VoiceBudget::VoiceBudget ()
+: enabled (false)
+, loadLimit (0.7f)
+, cap (0x7FFFFFFF)
+, capChanges (0)
+, shedVoices (0)
+, load (0.0f)
+, peakLoad (0.0f)
+, maxVoices (0x7FFFFFFF)
+, headroomBlocks (0)
+{
+}
+
+//-----------------------------------------------------------------------------
+void VoiceBudget::reset (int32 voices)
+{
+	maxVoices = voices;
+	headroomBlocks = 0;
+	cap.store (voices, std::memory_order_relaxed);
+	load.store (0.0f, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+int32 VoiceBudget::update (double renderSeconds, double deadlineSeconds, int32 activeVoices)
+{
+	if (deadlineSeconds <= 0.0)
+		return cap.load (std::memory_order_relaxed);
+
+	//负载上升时直接取新值（尖峰要马上反应），下降时平滑，避免上限来回跳
+	float now = (float)(renderSeconds / deadlineSeconds);
+	float smooth = load.load (std::memory_order_relaxed);
+	smooth = now > smooth ? now : smooth + 0.1f * (now - smooth);
+	load.store (smooth, std::memory_order_relaxed);
+	if (now > peakLoad.load (std::memory_order_relaxed))
+		peakLoad.store (now, std::memory_order_relaxed);
+
+	int32 current = cap.load (std::memory_order_relaxed);
+	int32 next = current;
+	float limit = loadLimit.load (std::memory_order_relaxed);
+	if (now > limit)
+	{
+		//超时：从实际在响的声部数往下砍四分之一（至少一个），砍多少由超出的程度决定
+		int32 base = std::min (current, activeVoices);
+		int32 cut = std::max (1, (int32)(base * std::min (0.5f, 0.25f * now / limit)));
+		next = std::max ((int32)kMinVoices, base - cut);
+		headroomBlocks = 0;
+	}
+	else if (smooth < 0.5f * limit && current < maxVoices)
+	{
+		//余量充足的块攒够了再加一个，升得慢、降得快
+		if (++headroomBlocks >= kRaiseBlocks)
+		{
+			next = current + 1;
+			headroomBlocks = 0;
+		}
+	}
+	else
+		headroomBlocks = 0;
+
+	if (next != current)
+	{
+		cap.store (next, std::memory_order_relaxed);
+		capChanges.fetch_add (1, std::memory_order_relaxed);
+	}
+	return next;
+}
+
+//-----------------------------------------------------------------------------
+int32 VoiceBudget::force (int32 newCap)
+{
+	//重放时耗时和录制时不同，上限不能再按负载算，直接用录下来的值
+	headroomBlocks = 0;
+	if (newCap != cap.load (std::memory_order_relaxed))
+	{
+		cap.store (newCap, std::memory_order_relaxed);
+		capChanges.fetch_add (1, std::memory_order_relaxed);
+	}
+	return newCap;
+}
+
+//-----------------------------------------------------------------------------
+void VoiceBudget::resetStats ()
+{
+	capChanges.store (0, std::memory_order_relaxed);
+	shedVoices.store (0, std::memory_order_relaxed);
+	peakLoad.store (0.0f, std::memory_order_relaxed);
+}
+
+}}} // namespaces
@@ -0,0 +1,71 @@
+/*
+ *  BKmdaPianoVoiceBudget.h
+ *  mda-vst3
+ *
+ *  按 CPU 预算自适应的复音上限。音频线程每块结束时报告渲染耗时和这一块的时限（帧数 / 采样率），
+ *  负载超过上限时立即降低声部上限，连续若干块有余量时再逐步升回去。
+ *  多出来的声部由处理器在几毫秒内淡出（见 PianoProcessor::shedVoices），不硬切。
+ *  上限、调整次数、淡出的声部数和负载都是原子量，其他线程随时可以读。
+ *  离线处理（processMode == kOffline）时处理器不调用 update，复音不受限制：没有实时时限，按耗时减声部只会让导出的结果
+ *  随机器负载变化，同一个工程导出两次可能不一样。重放 trace 时例外，处理器用 force 按录下的上限，重现录制时的输出。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <atomic>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+class VoiceBudget
+{
+public:
+	enum {
+		kMinVoices = 8,		//never shed below this
+		kRaiseBlocks = 16	//consecutive blocks with headroom before the cap goes up by one
+	};
+
+	VoiceBudget ();
+
+	// 非音频线程：是否启用、允许占用时限的比例（默认 0.7，多实例时按实例数调低）
+	void setEnabled (bool state) { enabled.store (state, std::memory_order_relaxed); }
+	bool isEnabled () const { return enabled.load (std::memory_order_relaxed); }
+	void setLoadLimit (float fraction) { loadLimit.store (fraction, std::memory_order_relaxed); }
+	float getLoadLimit () const { return loadLimit.load (std::memory_order_relaxed); }
+
+	// setActive 时调用：上限回到 maxVoices，负载清零（统计计数不清）
+	void reset (int32 maxVoices);
+
+	// 音频线程：报告一块的耗时，返回新的上限
+	int32 update (double renderSeconds, double deadlineSeconds, int32 activeVoices);
+	int32 force (int32 newCap);	//instead of update when replaying a trace: the cap the recording ended the block with
+	void addShedVoices (int32 count) { shedVoices.fetch_add ((uint64)count, std::memory_order_relaxed); }
+
+	// 任意线程
+	int32 getCap () const { return cap.load (std::memory_order_relaxed); }
+	uint64 getCapChanges () const { return capChanges.load (std::memory_order_relaxed); }
+	uint64 getShedVoices () const { return shedVoices.load (std::memory_order_relaxed); }
+	float getLoad () const { return load.load (std::memory_order_relaxed); }	//smoothed render time / deadline
+	float getPeakLoad () const { return peakLoad.load (std::memory_order_relaxed); }
+
+	void resetStats ();
+
+private:
+	std::atomic<bool> enabled;
+	std::atomic<float> loadLimit;
+	std::atomic<int32> cap;
+	std::atomic<uint64> capChanges;
+	std::atomic<uint64> shedVoices;
+	std::atomic<float> load;
+	std::atomic<float> peakLoad;
+
+	int32 maxVoices;	//audio thread only
+	int32 headroomBlocks;
+};
+
+}}} // namespaces
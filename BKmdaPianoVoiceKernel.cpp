@@ -0,0 +1,271 @@
+/*
+ *  BKmdaPianoVoiceKernel.cpp
+ *  mda-vst3
+ *
+ */
+
+#include "BKmdaPianoVoiceKernel.h"
+
+#include <cstring>
+
+#if MDA_PIANO_X86_KERNELS
+#include <immintrin.h>
+#if defined (_MSC_VER)
+#include <intrin.h>
+#define MDA_TARGET_SSE2
+#define MDA_TARGET_AVX2
+#else
+#define MDA_TARGET_SSE2 __attribute__ ((target ("sse2")))
+#define MDA_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#endif
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+void VoiceLanes::clear (int32 lane)
+{
+	//空位：不前进、不回绕、包络为 0，读 samples[0] 是安全的
+	delta[lane] = frac[lane] = pos[lane] = loop[lane] = 0;
+	end[lane] = 0x7FFFFFFF;
+	env[lane] = dec[lane] = 0.0f;
+	f0[lane] = f1[lane] = ff[lane] = 0.0f;
+	outl[lane] = outr[lane] = 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+// 所有通道在接下来多少帧之内都不会读过 end + kSampleGuard。
+// f 帧之后 pos = pos0 + ((frac0 + f * delta) >> 16)，中间不回绕。
+static int32 spanFrames (const VoiceLanes& V, int32 frames)
+{
+	int32 n = frames;
+	for (int32 k = 0; k < kVoiceLanes; k++)
+	{
+		if (V.delta[k] <= 0)
+			continue;	//空位
+		int64 room = (((int64)V.end[k] + kSampleGuard - V.pos[k]) << 16) + 0xFFFF - V.frac[k];
+		if ((int64)V.delta[k] * n > room)
+			n = (int32)(room / V.delta[k]);
+	}
+	return n > 0 ? n : 1;
+}
+
+//-----------------------------------------------------------------------------
+// 段末回绕，结果与逐帧 if (pos > end) pos -= loop 相同
+static void wrapLanes (VoiceLanes& V)
+{
+	for (int32 k = 0; k < kVoiceLanes; k++)
+		while (V.pos[k] > V.end[k]) V.pos[k] -= V.loop[k];
+}
+
+//-----------------------------------------------------------------------------
+// 按段渲染：段内没有回绕判断，内层循环没有分支
+template <void (*RenderSpan) (VoiceLanes&, const uint32*, float*, float*, int32)>
+static inline void renderSpans (VoiceLanes& V, const uint32* samples, float* laneL, float* laneR, int32 frames)
+{
+	for (int32 done = 0; done < frames;)
+	{
+		int32 n = spanFrames (V, frames - done);
+		RenderSpan (V, samples, laneL + done * kVoiceLanes, laneR + done * kVoiceLanes, n);
+		wrapLanes (V);
+		done += n;
+	}
+}
+
+//-----------------------------------------------------------------------------
+static void renderSpanScalar (VoiceLanes& V, const uint32* samples, float* laneL, float* laneR, int32 frames)
+{
+	for (int32 k = 0; k < kVoiceLanes; k++)
+	{
+		int32 delta = V.delta[k], frac = V.frac[k], pos = V.pos[k];
+		float env = V.env[k], dec = V.dec[k], f0 = V.f0[k], f1 = V.f1[k], ff = V.ff[k];
+		float outl = V.outl[k], outr = V.outr[k];
+
+		for (int32 f = 0; f < frames; f++)
+		{
+			frac += delta;
+			pos += frac >> 16;
+			frac &= 0xFFFF;
+			uint32 w = samples[pos];
+			int32 a = (int16)(w & 0xFFFF), b = (int32)w >> 16;
+			int32 i = a + ((frac * (b - a)) >> 16);
+			float x = env * (float)i / 32768.0f;
+
+			env = env * dec;  //envelope
+			f0 += ff * (x + f1 - f0);  //muffle filter
+			f1 = x;
+
+			laneL[f * kVoiceLanes + k] = outl * f0;
+			laneR[f * kVoiceLanes + k] = outr * f0;
+		}
+
+		V.frac[k] = frac;  V.pos[k] = pos;
+		V.env[k] = env;  V.f0[k] = f0;  V.f1[k] = f1;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void renderVoiceLanesScalar (VoiceLanes& V, const uint32* samples, float* laneL, float* laneR, int32 frames)
+{
+	renderSpans<renderSpanScalar> (V, samples, laneL, laneR, frames);
+}
+
+#if MDA_PIANO_X86_KERNELS
+//-----------------------------------------------------------------------------
+// SSE2 没有 32 位乘法取低位（_mm_mullo_epi32 是 SSE4.1），用两次 _mm_mul_epu32 拼出来，
+// 结果与标量 int32 乘法的回绕结果相同。
+MDA_TARGET_SSE2 static inline __m128i mullo_epi32_sse2 (__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32 (a, b);
+	__m128i odd = _mm_mul_epu32 (_mm_srli_si128 (a, 4), _mm_srli_si128 (b, 4));
+	return _mm_unpacklo_epi32 (_mm_shuffle_epi32 (even, _MM_SHUFFLE (0, 0, 2, 0)),
+	                           _mm_shuffle_epi32 (odd, _MM_SHUFFLE (0, 0, 2, 0)));
+}
+
+//-----------------------------------------------------------------------------
+MDA_TARGET_SSE2 static void renderSpanSSE2 (VoiceLanes& V, const uint32* samples, float* laneL, float* laneR, int32 frames)
+{
+	const __m128i mask = _mm_set1_epi32 (0xFFFF);
+	const __m128 scale = _mm_set1_ps (1.0f / 32768.0f);
+	alignas (16) int32 p[4];
+	alignas (16) uint32 w[4];
+
+	for (int32 h = 0; h < kVoiceLanes; h += 4)
+	{
+		__m128i delta = _mm_load_si128 ((const __m128i*)(V.delta + h));
+		__m128i frac = _mm_load_si128 ((const __m128i*)(V.frac + h));
+		__m128i pos = _mm_load_si128 ((const __m128i*)(V.pos + h));
+		__m128 env = _mm_load_ps (V.env + h), dec = _mm_load_ps (V.dec + h);
+		__m128 f0 = _mm_load_ps (V.f0 + h), f1 = _mm_load_ps (V.f1 + h), ff = _mm_load_ps (V.ff + h);
+		__m128 outl = _mm_load_ps (V.outl + h), outr = _mm_load_ps (V.outr + h);
+
+		for (int32 f = 0; f < frames; f++)
+		{
+			frac = _mm_add_epi32 (frac, delta);
+			pos = _mm_add_epi32 (pos, _mm_srai_epi32 (frac, 16));
+			frac = _mm_and_si128 (frac, mask);
+
+			//SSE2 没有 gather，逐个读取；每次读到 waves[pos] 和 waves[pos+1] 两个点
+			_mm_store_si128 ((__m128i*)p, pos);
+			w[0] = samples[p[0]];  w[1] = samples[p[1]];  w[2] = samples[p[2]];  w[3] = samples[p[3]];
+			__m128i ww = _mm_load_si128 ((const __m128i*)w);
+			__m128i wa = _mm_srai_epi32 (_mm_slli_epi32 (ww, 16), 16);
+			__m128i wb = _mm_srai_epi32 (ww, 16);
+			__m128i i = _mm_add_epi32 (wa, _mm_srai_epi32 (mullo_epi32_sse2 (frac, _mm_sub_epi32 (wb, wa)), 16));
+			__m128 x = _mm_mul_ps (_mm_mul_ps (env, _mm_cvtepi32_ps (i)), scale);
+
+			env = _mm_mul_ps (env, dec);
+			f0 = _mm_add_ps (f0, _mm_mul_ps (ff, _mm_sub_ps (_mm_add_ps (x, f1), f0)));
+			f1 = x;
+
+			_mm_store_ps (laneL + f * kVoiceLanes + h, _mm_mul_ps (outl, f0));
+			_mm_store_ps (laneR + f * kVoiceLanes + h, _mm_mul_ps (outr, f0));
+		}
+
+		_mm_store_si128 ((__m128i*)(V.frac + h), frac);
+		_mm_store_si128 ((__m128i*)(V.pos + h), pos);
+		_mm_store_ps (V.env + h, env);
+		_mm_store_ps (V.f0 + h, f0);
+		_mm_store_ps (V.f1 + h, f1);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void renderVoiceLanesSSE2 (VoiceLanes& V, const uint32* samples, float* laneL, float* laneR, int32 frames)
+{
+	renderSpans<renderSpanSSE2> (V, samples, laneL, laneR, frames);
+}
+
+//-----------------------------------------------------------------------------
+MDA_TARGET_AVX2 static void renderSpanAVX2 (VoiceLanes& V, const uint32* samples, float* laneL, float* laneR, int32 frames)
+{
+	const __m256i mask = _mm256_set1_epi32 (0xFFFF);
+	const __m256 scale = _mm256_set1_ps (1.0f / 32768.0f);
+
+	__m256i delta = _mm256_load_si256 ((const __m256i*)V.delta);
+	__m256i frac = _mm256_load_si256 ((const __m256i*)V.frac);
+	__m256i pos = _mm256_load_si256 ((const __m256i*)V.pos);
+	__m256 env = _mm256_load_ps (V.env), dec = _mm256_load_ps (V.dec);
+	__m256 f0 = _mm256_load_ps (V.f0), f1 = _mm256_load_ps (V.f1), ff = _mm256_load_ps (V.ff);
+	__m256 outl = _mm256_load_ps (V.outl), outr = _mm256_load_ps (V.outr);
+
+	for (int32 f = 0; f < frames; f++)
+	{
+		frac = _mm256_add_epi32 (frac, delta);
+		pos = _mm256_add_epi32 (pos, _mm256_srai_epi32 (frac, 16));
+		frac = _mm256_and_si256 (frac, mask);
+
+		//一次 gather 同时取到 waves[pos]（低 16 位）和 waves[pos+1]（高 16 位）
+		__m256i w = _mm256_i32gather_epi32 ((const int*)samples, pos, 4);
+		__m256i wa = _mm256_srai_epi32 (_mm256_slli_epi32 (w, 16), 16);
+		__m256i wb = _mm256_srai_epi32 (w, 16);
+		__m256i i = _mm256_add_epi32 (wa, _mm256_srai_epi32 (_mm256_mullo_epi32 (frac, _mm256_sub_epi32 (wb, wa)), 16));
+		__m256 x = _mm256_mul_ps (_mm256_mul_ps (env, _mm256_cvtepi32_ps (i)), scale);
+
+		env = _mm256_mul_ps (env, dec);
+		f0 = _mm256_add_ps (f0, _mm256_mul_ps (ff, _mm256_sub_ps (_mm256_add_ps (x, f1), f0)));
+		f1 = x;
+
+		_mm256_store_ps (laneL + f * kVoiceLanes, _mm256_mul_ps (outl, f0));
+		_mm256_store_ps (laneR + f * kVoiceLanes, _mm256_mul_ps (outr, f0));
+	}
+
+	_mm256_store_si256 ((__m256i*)V.frac, frac);
+	_mm256_store_si256 ((__m256i*)V.pos, pos);
+	_mm256_store_ps (V.env, env);
+	_mm256_store_ps (V.f0, f0);
+	_mm256_store_ps (V.f1, f1);
+}
+
+//-----------------------------------------------------------------------------
+void renderVoiceLanesAVX2 (VoiceLanes& V, const uint32* samples, float* laneL, float* laneR, int32 frames)
+{
+	renderSpans<renderSpanAVX2> (V, samples, laneL, laneR, frames);
+}
+
+//-----------------------------------------------------------------------------
+static bool cpuHasAVX2 ()
+{
+#if defined (_MSC_VER)
+	int info[4];
+	__cpuid (info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid (info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv (0) & 6) != 6)
+		return false;
+	__cpuidex (info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("avx2");
+#endif
+}
+#endif // MDA_PIANO_X86_KERNELS
+
+//-----------------------------------------------------------------------------
+VoiceKernel getVoiceKernel ()
+{
+#if MDA_PIANO_X86_KERNELS
+	static const VoiceKernel kernel = cpuHasAVX2 () ? renderVoiceLanesAVX2 : renderVoiceLanesSSE2;
+	return kernel;
+#else
+	return renderVoiceLanesScalar;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+const char* getVoiceKernelName (VoiceKernel kernel)
+{
+#if MDA_PIANO_X86_KERNELS
+	if (kernel == renderVoiceLanesAVX2) return "avx2";
+	if (kernel == renderVoiceLanesSSE2) return "sse2";
+#endif
+	return "scalar";
+}
+
+}}} // namespaces
@@ -0,0 +1,67 @@
+/*
+ *  BKmdaPianoVoiceKernel.h
+ *  mda-vst3
+ *
+ *  SIMD 声部渲染内核：声部状态按 8 个一组的 SoA 方式存放（AoSoA），
+ *  一组声部在同一条向量指令里完成插值、包络和闷音滤波。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+enum {
+	kVoiceLanes = 8,	//voices per lane group (AVX2 width, 2x SSE2)
+	kSampleGuard = 4096	//unrolled loop positions after each keygroup's end (SampleCache)
+};
+
+//-----------------------------------------------------------------------------
+// 一组 kVoiceLanes 个声部的 SoA 状态，字段含义与 PianoProcessor::VOICE 相同。
+// 不足 kVoiceLanes 的空位由 VoiceLanes::clear 填成静音，内核照算但结果为 0。
+struct alignas (64) VoiceLanes
+{
+	int32 delta[kVoiceLanes];  //sample playback
+	int32 frac[kVoiceLanes];
+	int32 pos[kVoiceLanes];
+	int32 end[kVoiceLanes];
+	int32 loop[kVoiceLanes];
+
+	float env[kVoiceLanes];  //envelope
+	float dec[kVoiceLanes];
+
+	float f0[kVoiceLanes];   //first-order LPF
+	float f1[kVoiceLanes];
+	float ff[kVoiceLanes];
+
+	float outl[kVoiceLanes];
+	float outr[kVoiceLanes];
+
+	void clear (int32 lane);
+};
+
+//-----------------------------------------------------------------------------
+// 渲染一组声部 frames 帧。每帧每个声部的 outl*f0 / outr*f0 写到
+// laneL[f * kVoiceLanes + lane] / laneR[...]，由调用者按声部顺序累加，
+// 这样混音顺序与逐声部标量循环一致，输出逐位相同。
+// samples 是 SampleCache 的数据：samples[p] 低 16 位为 waves[p]，高 16 位为 waves[p+1]，
+// 每个键组 end 之后有 kSampleGuard 个展开的回绕位置。
+typedef void (*VoiceKernel) (VoiceLanes& lanes, const uint32* samples, float* laneL, float* laneR, int32 frames);
+
+void renderVoiceLanesScalar (VoiceLanes& lanes, const uint32* samples, float* laneL, float* laneR, int32 frames);
+#if defined (__x86_64__) || defined (_M_X64) || defined (__i386__) || defined (_M_IX86)
+#define MDA_PIANO_X86_KERNELS 1
+void renderVoiceLanesSSE2 (VoiceLanes& lanes, const uint32* samples, float* laneL, float* laneR, int32 frames);
+void renderVoiceLanesAVX2 (VoiceLanes& lanes, const uint32* samples, float* laneL, float* laneR, int32 frames);
+#endif
+
+// 运行时按 CPU 能力选择内核：AVX2 > SSE2 > 标量
+VoiceKernel getVoiceKernel ();
+const char* getVoiceKernelName (VoiceKernel kernel);
+
+}}} // namespaces
@@ -0,0 +1,230 @@
+/*
+ *  BKmdaPianoVoiceMap.h
+ *  mda-vst3
+ *
+ *  声部索引：
+ *  NoteIdMap     noteId -> 声部槽位，note-off 和踏板抬起时不再扫描全部声部
+ *  QuietVoiceIndex 按包络量级分桶，抢占声部时直接从最低的桶里找最安静的声部
+ *  两者都只记录活跃声部，增加、抢占和压缩（voice[v] = voice[--activevoices]）时同步更新。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <cstring>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+// 固定容量的声部位集合
+template <int32 NumVoices>
+class VoiceSet
+{
+public:
+	enum { kWords = (NumVoices + 63) / 64 };
+
+	VoiceSet () { clear (); }
+
+	void clear () { memset (bits, 0, sizeof (bits)); }
+	void set (int32 v) { bits[v >> 6] |= (uint64)1 << (v & 63); }
+	void reset (int32 v) { bits[v >> 6] &= ~((uint64)1 << (v & 63)); }
+	bool test (int32 v) const { return (bits[v >> 6] >> (v & 63)) & 1; }
+
+	bool empty () const
+	{
+		for (int32 w = 0; w < kWords; w++)
+			if (bits[w]) return false;
+		return true;
+	}
+
+	// 第一个 >= from 的声部，没有则返回 -1
+	int32 next (int32 from) const
+	{
+		for (int32 w = from >> 6; w < kWords; w++)
+		{
+			uint64 word = bits[w];
+			if (w == (from >> 6)) word &= ~(uint64)0 << (from & 63);
+			if (word) return (w << 6) + lowestBit (word);
+		}
+		return -1;
+	}
+
+	static int32 lowestBit (uint64 word)
+	{
+#if defined (_MSC_VER) && !defined (__clang__)
+		unsigned long index;
+		_BitScanForward64 (&index, word);
+		return (int32)index;
+#else
+		return __builtin_ctzll (word);
+#endif
+	}
+
+private:
+	uint64 bits[kWords];
+};
+
+//-----------------------------------------------------------------------------
+// noteId -> 槽位的哈希表，冲突用槽位之间的双向链表解决。
+// 同一个 noteId 可以对应多个声部（宿主不支持 note id 时全部是 -1，延音的声部也都是 SustainNoteID）。
+template <int32 NumVoices>
+class NoteIdMap
+{
+public:
+	enum { kBucketBits = NumVoices <= 128 ? 7 : NumVoices <= 256 ? 8 : NumVoices <= 512 ? 9 : 10, kBuckets = 1 << kBucketBits, kNone = -1 };
+	static_assert (kBuckets >= NumVoices, "keep the load factor below one");
+
+	NoteIdMap () { clear (); }
+
+	void clear ()
+	{
+		for (auto& h : head) h = kNone;
+		for (int32 v = 0; v < NumVoices; v++)
+			prev[v] = next[v] = kNone, key[v] = 0, used[v] = false;
+	}
+
+	void insert (int32 noteId, int32 slot)
+	{
+		int32 b = bucketOf (noteId);
+		key[slot] = noteId;
+		used[slot] = true;
+		prev[slot] = kNone;
+		next[slot] = head[b];
+		if (head[b] != kNone) prev[head[b]] = slot;
+		head[b] = slot;
+	}
+
+	void erase (int32 slot)
+	{
+		if (!used[slot])
+			return;
+		if (prev[slot] != kNone) next[prev[slot]] = next[slot];
+		else head[bucketOf (key[slot])] = next[slot];
+		if (next[slot] != kNone) prev[next[slot]] = prev[slot];
+		prev[slot] = next[slot] = kNone;
+		used[slot] = false;
+	}
+
+	// 槽位 from 的声部被拷贝到空槽位 to
+	void move (int32 from, int32 to)
+	{
+		if (!used[from])
+			return;
+		int32 noteId = key[from];
+		erase (from);
+		insert (noteId, to);
+	}
+
+	// 把所有 noteId 匹配的槽位写到 slots，返回个数
+	int32 find (int32 noteId, int32* slots) const
+	{
+		int32 count = 0;
+		for (int32 v = head[bucketOf (noteId)]; v != kNone; v = next[v])
+			if (key[v] == noteId) slots[count++] = v;
+		return count;
+	}
+
+private:
+	static int32 bucketOf (int32 noteId) { return (int32)(((uint32)noteId * 2654435761u) >> (32 - kBucketBits)); }
+
+	int32 head[kBuckets];
+	int32 prev[NumVoices];
+	int32 next[NumVoices];
+	int32 key[NumVoices];
+	bool used[NumVoices];
+};
+
+//-----------------------------------------------------------------------------
+// 按 env 的二进制指数分桶（每桶 6 dB）。env 只在 unpackVoices 和 note-on 时更新桶，
+// 找最安静声部时从最低的非空桶开始，只需比较桶内的少数几个声部。
+template <int32 NumVoices>
+class QuietVoiceIndex
+{
+public:
+	enum { kBuckets = 32, kNone = -1 };
+
+	QuietVoiceIndex () { clear (); }
+
+	void clear ()
+	{
+		for (auto& b : buckets) b.clear ();
+		for (auto& b : bucket) b = kNone;
+	}
+
+	void update (int32 slot, float env)
+	{
+		int32 b = bucketOf (env);
+		if (bucket[slot] == b)
+			return;
+		if (bucket[slot] != kNone) buckets[bucket[slot]].reset (slot);
+		buckets[b].set (slot);
+		bucket[slot] = b;
+	}
+
+	void erase (int32 slot)
+	{
+		if (bucket[slot] == kNone)
+			return;
+		buckets[bucket[slot]].reset (slot);
+		bucket[slot] = kNone;
+	}
+
+	void move (int32 from, int32 to)
+	{
+		int32 b = bucket[from];
+		erase (from);
+		erase (to);
+		if (b != kNone)
+		{
+			buckets[b].set (to);
+			bucket[to] = b;
+		}
+	}
+
+	// 槽位 [0, limit) 中 env 最小的声部，相同时取编号小的（与线性扫描结果一致）
+	template <class EnvOf>
+	int32 findQuietest (int32 limit, EnvOf envOf) const
+	{
+		return findQuietest (limit, envOf, [] (int32) { return true; });
+	}
+
+	// 同上，只在 accept (v) 为 true 的声部里找（例如只找某个声部组合的声部）
+	template <class EnvOf, class Accept>
+	int32 findQuietest (int32 limit, EnvOf envOf, Accept accept) const
+	{
+		for (int32 b = 0; b < kBuckets; b++)
+		{
+			int32 best = kNone;
+			float quietest = 0.0f;
+			for (int32 v = buckets[b].next (0); v != -1 && v < limit; v = buckets[b].next (v + 1))
+			{
+				if (!accept (v))
+					continue;
+				float env = envOf (v);
+				if (best == kNone || env < quietest) { best = v;  quietest = env; }
+			}
+			if (best != kNone)
+				return best;
+		}
+		return kNone;
+	}
+
+private:
+	static int32 bucketOf (float env)
+	{
+		uint32 bits;
+		memcpy (&bits, &env, sizeof (bits));
+		int32 exponent = (int32)((bits >> 23) & 0xFF) - 96;	//2^-31 .. 2^0 -> 0 .. 31
+		if ((int32)bits <= 0 || exponent < 0) return 0;
+		return exponent < kBuckets ? exponent : kBuckets - 1;
+	}
+
+	VoiceSet<NumVoices> buckets[kBuckets];
+	int32 bucket[NumVoices];
+};
+
+}}} // namespaces
@@ -0,0 +1,438 @@
+/*
+ *  BKmdaPianoBench.cpp
+ *  mda-vst3
+ *
+ *  DSP 核心的微基准：不经过宿主，用 SDK 的 hosting 辅助类驱动 PianoProcessor，
+ *  在合成的事件流上测 doProcessing / noteEvent / recalculate 的整体开销。
+ *    chord8/16/32   持续的 8/16/32 音和弦，每秒重新按一次
+ *    staccato       每 100 ms 一串 24 个短音，复音上限 16，必然抢占
+ *    glissando      踩住踏板的上行刮奏，每 25 ms 一个音
+ *    modwheel       16 音和弦，调制轮每块变化（muff 跟着变）
+ *    parts16        16 音和弦分在 16 个 MIDI 通道上，每个声部组合用不同的 program
+ *                   （MDA_PIANO_NUM_PARTS 个组合共用一个声部池；只有 1 个组合时全部落在第 0 个上）
+ *  每个场景在 44.1/96/192 kHz、块大小 16..4096、32/64 位输出下各跑一遍（取 --repeat 次里最快的一次），
+ *  只对 process () 计时，输出 ns/sample、ns/sample/voice、实时倍数，以及 process () 里的内存分配次数（应该为 0）。
+ *  64 位的结果另外给出相对同条件 32 位的耗时比（vsFloat）。
+ *  --compressed 时声部读压缩的采样存储，另外给出解码的帧数和解码耗时（解码只在遥测打开时计时，所以这时打开遥测）；
+ *  sampleBytes 是声部读的采样数据占用的内存（包括 MDA_PIANO_MIP_LEVELS 级降采样副本，级数记在 mipLevels 里）。
+ *  结果是固定格式的 JSON（schema 字段变了才会改格式），可以直接存档做回归比较。
+ *
+ *  c++ -O2 -std=c++17 -I.. -I<vst3sdk> BKmdaPianoBench.cpp ../BKmdaPiano*.cpp ../mdaPianoController.cpp <sdk sources> -lpthread
+ *
+ *  用法：BKmdaPianoBench [--seconds s] [--repeat n] [--filter scenario] [--compressed] [-o result.json]
+ *
+ */
+
+#include "BKmdaPianoProcessor.h"
+#include "BKmdaPianoSampleMips.h"
+#include "mdaPianoController.h"
+#include "public.sdk/source/vst/hosting/eventlist.h"
+#include "public.sdk/source/vst/hosting/parameterchanges.h"
+#include "public.sdk/source/vst/hosting/processdata.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+using namespace Steinberg::Vst::mda;
+
+//-----------------------------------------------------------------------------
+// 计数全局 new：只在计时区间内打开，音频路径上任何分配都会出现在结果里
+static std::atomic<bool> countAllocations (false);
+static std::atomic<uint64> allocationCount (0);
+static std::atomic<uint64> allocationBytes (0);
+
+#if defined (__GNUC__) && !defined (__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"	//new and delete below are a malloc/free pair
+#endif
+
+void* operator new (size_t size)
+{
+	if (countAllocations.load (std::memory_order_relaxed))
+	{
+		allocationCount.fetch_add (1, std::memory_order_relaxed);
+		allocationBytes.fetch_add (size, std::memory_order_relaxed);
+	}
+	if (void* p = malloc (size ? size : 1))
+		return p;
+	throw std::bad_alloc ();
+}
+
+void operator delete (void* p) noexcept { free (p); }
+void operator delete (void* p, size_t) noexcept { operator delete (p); }
+void* operator new[] (size_t size) { return operator new (size); }
+void operator delete[] (void* p) noexcept { operator delete (p); }
+void operator delete[] (void* p, size_t) noexcept { operator delete (p); }
+
+namespace {
+
+enum {
+	kPolyParam = 8,	//polyphony, normalized
+	kMaxEventsPerBlock = 1024
+};
+
+//-----------------------------------------------------------------------------
+struct BenchProcessor : PianoProcessor
+{
+	int32 getActiveVoices () const { return synthData.activevoices; }
+};
+
+//-----------------------------------------------------------------------------
+struct ScriptEvent
+{
+	enum Kind { kNoteOn, kNoteOff, kParam };
+	int64 frame;
+	Kind kind;
+	int32 pitch;
+	float velocity;
+	ParamID id;
+	ParamValue value;
+	int16 channel;
+};
+
+struct Scenario
+{
+	const char* name;
+	double poly;	//normalized polyphony parameter
+	void (*build) (std::vector<ScriptEvent>& events, double rate, int64 frames);
+};
+
+static void noteOn (std::vector<ScriptEvent>& e, int64 frame, int32 pitch, float velocity, int16 channel = 0)
+{
+	e.push_back ({frame, ScriptEvent::kNoteOn, pitch, velocity, 0, 0.0, channel});
+}
+
+static void noteOff (std::vector<ScriptEvent>& e, int64 frame, int32 pitch, int16 channel = 0)
+{
+	e.push_back ({frame, ScriptEvent::kNoteOff, pitch, 0.0f, 0, 0.0, channel});
+}
+
+static void param (std::vector<ScriptEvent>& e, int64 frame, ParamID id, ParamValue value)
+{
+	e.push_back ({frame, ScriptEvent::kParam, 0, 0.0f, id, value, 0});
+}
+
+//-----------------------------------------------------------------------------
+static void buildChord (std::vector<ScriptEvent>& e, double rate, int64 frames, int32 voices)
+{
+	//每秒松开再按下，声部数保持在 voices 附近（松开的声部在释音里和新声部重叠很短）
+	int64 period = (int64)rate;
+	for (int64 t = 0; t < frames; t += period)
+	{
+		for (int32 i = 0; i < voices; i++)
+		{
+			int32 pitch = 28 + (i * 67) % 72;	//spread over the keyboard, all distinct for i < 72
+			if (t > 0) noteOff (e, t - 1, pitch);
+			noteOn (e, t, pitch, 0.5f + 0.015f * (i % 32));
+		}
+	}
+}
+
+static void buildChord8 (std::vector<ScriptEvent>& e, double rate, int64 frames) { buildChord (e, rate, frames, 8); }
+static void buildChord16 (std::vector<ScriptEvent>& e, double rate, int64 frames) { buildChord (e, rate, frames, 16); }
+static void buildChord32 (std::vector<ScriptEvent>& e, double rate, int64 frames) { buildChord (e, rate, frames, 32); }
+
+static void buildStaccato (std::vector<ScriptEvent>& e, double rate, int64 frames)
+{
+	int64 period = (int64)(0.1 * rate), step = (int64)(0.002 * rate), length = (int64)(0.03 * rate);
+	uint32 seed = 1;
+	for (int64 t = 0; t < frames; t += period)
+		for (int32 i = 0; i < 24; i++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			int32 pitch = 36 + (int32)((seed >> 16) % 60);
+			noteOn (e, t + i * step, pitch, 0.9f);
+			noteOff (e, t + i * step + length, pitch);
+		}
+}
+
+static void buildGlissando (std::vector<ScriptEvent>& e, double rate, int64 frames)
+{
+	int64 step = (int64)(0.025 * rate);
+	param (e, 0, BaseController::kSustainParam, 1.0);
+	int32 n = 0;
+	for (int64 t = 0; t < frames; t += step, n++)
+	{
+		int32 pitch = 21 + n % 88;
+		noteOn (e, t, pitch, 0.7f);
+		noteOff (e, t + step / 2, pitch);
+		if (n % 88 == 87)	//每刮完一遍换一次踏板
+		{
+			param (e, t + step - 2, BaseController::kSustainParam, 0.0);
+			param (e, t + step - 1, BaseController::kSustainParam, 1.0);
+		}
+	}
+}
+
+static void buildModWheel (std::vector<ScriptEvent>& e, double rate, int64 frames)
+{
+	buildChord (e, rate, frames, 16);
+	int64 step = (int64)(0.005 * rate);	//200 Hz control rate
+	for (int64 t = 0; t < frames; t += step)
+		param (e, t, BaseController::kModWheelParam, 0.5 + 0.5 * sin (6.283185307 * (double)t / rate));
+}
+
+static void buildParts (std::vector<ScriptEvent>& e, double rate, int64 frames)
+{
+	//和 chord16 相同的音，第 i 个音在通道 i 上；声部组合 p 用 program p % kNumPrograms
+	for (int32 p = 1; p < PianoProcessor::kNumParts; p++)
+	{
+		param (e, 0, PianoProcessor::partParamID (p, PianoProcessor::kPartProgram), (p % 8 + 0.5) / 8.0);
+		param (e, 0, PianoProcessor::partParamID (p, kPolyParam), 1.0);	//after the program, which sets it too
+	}
+	int64 period = (int64)rate;
+	for (int64 t = 0; t < frames; t += period)
+	{
+		for (int32 i = 0; i < 16; i++)
+		{
+			int32 pitch = 28 + (i * 67) % 72;
+			if (t > 0) noteOff (e, t - 1, pitch, (int16)i);
+			noteOn (e, t, pitch, 0.5f + 0.015f * i, (int16)i);
+		}
+	}
+}
+
+static const Scenario scenarios[] = {
+	{"chord8",    1.0, buildChord8},
+	{"chord16",   1.0, buildChord16},
+	{"chord32",   1.0, buildChord32},
+	{"staccato",  0.33, buildStaccato},	//8 + (int32)(24.9 * 0.33) = 16 voices
+	{"glissando", 1.0, buildGlissando},
+	{"modwheel",  1.0, buildModWheel},
+	{"parts16",   1.0, buildParts},
+};
+
+static const double sampleRates[] = {44100.0, 96000.0, 192000.0};
+static const int32 blockSizes[] = {16, 64, 256, 1024, 4096};
+static const int32 sampleSizes[] = {kSample32, kSample64};	//float first: the double result is reported relative to it
+
+//-----------------------------------------------------------------------------
+struct Result
+{
+	std::string scenario;
+	double sampleRate;
+	int32 blockSize;
+	int32 sampleSize;	//32 or 64
+	int64 frames;
+	double seconds;	//fastest repeat
+	double voices;	//active voices averaged over blocks
+	uint64 allocations;
+	uint64 allocatedBytes;
+	double vsFloat;	//seconds relative to the same case with 32-bit output
+	uint64 sampleBytes;
+	uint64 framesDecoded;	//compressed samples only
+	double decodeSeconds;
+};
+
+//-----------------------------------------------------------------------------
+static Result runOnce (const Scenario& scenario, const std::vector<ScriptEvent>& script, double rate, int32 blockSize,
+                       int32 symbolicSampleSize, bool compressed, int64 frames)
+{
+	BenchProcessor* processor = new BenchProcessor;
+	processor->setCompressedSamples (compressed);
+	processor->getTelemetry ().setEnabled (compressed);	//decode timing
+	processor->initialize (nullptr);
+	ProcessSetup setup {kRealtime, symbolicSampleSize, blockSize, rate};
+	processor->setupProcessing (setup);
+	processor->setActive (true);
+	processor->setProcessing (true);
+
+	HostProcessData data;
+	data.prepare (*processor, blockSize, symbolicSampleSize);
+	EventList eventList (kMaxEventsPerBlock);
+	ParameterChanges paramChanges (16);
+	data.inputEvents = &eventList;
+	data.inputParameterChanges = &paramChanges;
+
+	std::vector<int32> held (128, -1);	//pitch -> noteId
+	int32 nextNoteId = 0;
+	size_t next = 0;
+	double voiceSum = 0.0;
+	int64 blocks = 0;
+
+	//只统计 process () 本身：事件列表的准备不计时，也不计分配
+	allocationCount = 0;
+	allocationBytes = 0;
+	double seconds = 0.0;
+	for (int64 frame = 0; frame < frames; frame += blockSize)
+	{
+		int32 n = (int32)std::min<int64> (blockSize, frames - frame);
+		eventList.clear ();
+		paramChanges.clearQueue ();
+		int32 index, point;
+		if (frame == 0)
+			paramChanges.addParameterData (kPolyParam, index)->addPoint (0, scenario.poly, point);
+
+		for (; next < script.size () && script[next].frame < frame + n; next++)
+		{
+			const ScriptEvent& s = script[next];
+			int32 offset = (int32)(s.frame - frame);
+			if (s.kind == ScriptEvent::kParam)
+			{
+				if (IParamValueQueue* queue = paramChanges.addParameterData (s.id, index))
+					queue->addPoint (offset, s.value, point);
+				continue;
+			}
+			Event e {};
+			e.sampleOffset = offset;
+			if (s.kind == ScriptEvent::kNoteOn)
+			{
+				e.type = Event::kNoteOnEvent;
+				e.noteOn.channel = s.channel;
+				e.noteOn.pitch = (int16)s.pitch;  e.noteOn.velocity = s.velocity;
+				e.noteOn.noteId = held[s.pitch] = nextNoteId++;
+			}
+			else
+			{
+				e.type = Event::kNoteOffEvent;
+				e.noteOff.channel = s.channel;
+				e.noteOff.pitch = (int16)s.pitch;
+				e.noteOff.noteId = held[s.pitch];
+			}
+			eventList.addEvent (e);
+		}
+
+		data.numSamples = n;
+		countAllocations = true;
+		auto t0 = std::chrono::steady_clock::now ();
+		processor->process (data);
+		seconds += std::chrono::duration<double> (std::chrono::steady_clock::now () - t0).count ();
+		countAllocations = false;
+		voiceSum += processor->getActiveVoices ();
+		blocks++;
+	}
+
+	Result result;
+	result.scenario = scenario.name;
+	result.sampleRate = rate;
+	result.blockSize = blockSize;
+	result.sampleSize = symbolicSampleSize == kSample64 ? 64 : 32;
+	result.frames = frames;
+	result.seconds = seconds;
+	result.voices = blocks > 0 ? voiceSum / (double)blocks : 0.0;
+	result.allocations = allocationCount;
+	result.allocatedBytes = allocationBytes;
+	result.vsFloat = 1.0;
+	result.sampleBytes = processor->getSampleMemory ();
+	result.framesDecoded = processor->getFrameCache ().getDecodedFrames ();
+	result.decodeSeconds = (double)processor->getFrameCache ().getDecodeNs () * 1.0e-9;
+
+	processor->setProcessing (false);
+	processor->setActive (false);
+	processor->terminate ();
+	processor->release ();
+	data.unprepare ();
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+static void writeJson (FILE* out, const std::vector<Result>& results, double seconds, int32 repeat, bool compressed)
+{
+	//字段顺序固定，数值格式固定，方便直接 diff 或被脚本读取
+	fprintf (out, "{\n  \"schema\": 5,\n  \"kernel\": \"%s\",\n  \"voices\": %d,\n  \"parts\": %d,\n  \"samples\": \"%s\",\n  \"mipLevels\": %d,\n"
+		"  \"seconds\": %.3f,\n  \"repeat\": %d,\n  \"results\": [\n",
+		getVoiceKernelName (getVoiceKernel ()), (int)MDA_PIANO_NUM_VOICES, (int)PianoProcessor::kNumParts, compressed ? "compressed" : "unrolled",
+		(int)MDA_PIANO_MIP_LEVELS, seconds, repeat);
+	for (size_t i = 0; i < results.size (); i++)
+	{
+		const Result& r = results[i];
+		double ns = r.seconds * 1.0e9;
+		double perSample = ns / (double)r.frames;
+		double perVoice = r.voices > 0.0 ? perSample / r.voices : 0.0;
+		double realtime = r.seconds > 0.0 ? ((double)r.frames / r.sampleRate) / r.seconds : 0.0;
+		double decodeNs = r.decodeSeconds * 1.0e9 / (double)r.frames;
+		fprintf (out, "    {\"scenario\": \"%s\", \"sampleRate\": %.0f, \"blockSize\": %d, \"sampleSize\": %d, \"frames\": %lld, "
+			"\"avgVoices\": %.2f, \"nsPerSample\": %.2f, \"nsPerSampleVoice\": %.3f, \"realtime\": %.1f, \"vsFloat\": %.3f, "
+			"\"sampleBytes\": %llu, \"framesDecoded\": %llu, \"decodeNsPerSample\": %.2f, "
+			"\"allocations\": %llu, \"allocatedBytes\": %llu}%s\n",
+			r.scenario.c_str (), r.sampleRate, r.blockSize, r.sampleSize, (long long)r.frames,
+			r.voices, perSample, perVoice, realtime, r.vsFloat,
+			(unsigned long long)r.sampleBytes, (unsigned long long)r.framesDecoded, decodeNs,
+			(unsigned long long)r.allocations, (unsigned long long)r.allocatedBytes,
+			i + 1 < results.size () ? "," : "");
+	}
+	fprintf (out, "  ]\n}\n");
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+int main (int argc, char** argv)
+{
+	double seconds = 2.0;
+	int32 repeat = 3;
+	const char* filter = nullptr;
+	const char* outPath = nullptr;
+	bool compressed = false;
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (!strcmp (argv[i], "--seconds") && hasValue) seconds = atof (argv[++i]);
+		else if (!strcmp (argv[i], "--repeat") && hasValue) repeat = std::max (1, atoi (argv[++i]));
+		else if (!strcmp (argv[i], "--filter") && hasValue) filter = argv[++i];
+		else if (!strcmp (argv[i], "--compressed")) compressed = true;
+		else if (!strcmp (argv[i], "-o") && hasValue) outPath = argv[++i];
+		else
+		{
+			fprintf (stderr, "usage: BKmdaPianoBench [--seconds s] [--repeat n] [--filter scenario] [--compressed] [-o result.json]\n");
+			return 2;
+		}
+	}
+
+	std::vector<Result> results;
+	for (const Scenario& scenario : scenarios)
+	{
+		if (filter && !strstr (scenario.name, filter))
+			continue;
+		for (double rate : sampleRates)
+		{
+			int64 frames = (int64)(seconds * rate);
+			std::vector<ScriptEvent> script;
+			scenario.build (script, rate, frames);
+			std::stable_sort (script.begin (), script.end (), [] (const ScriptEvent& a, const ScriptEvent& b) { return a.frame < b.frame; });
+
+			for (int32 blockSize : blockSizes)
+			{
+				double floatSeconds = 0.0;
+				for (int32 sampleSize : sampleSizes)
+				{
+					Result best {};
+					for (int32 r = 0; r < repeat; r++)
+					{
+						Result result = runOnce (scenario, script, rate, blockSize, sampleSize, compressed, frames);
+						if (r == 0 || result.seconds < best.seconds)
+							best = result;
+					}
+					if (sampleSize == kSample32)
+						floatSeconds = best.seconds;
+					else if (floatSeconds > 0.0)
+						best.vsFloat = best.seconds / floatSeconds;
+					results.push_back (best);
+					fprintf (stderr, "%-10s %6.0f Hz %5d frames %2d bit  %8.2f ns/sample  %7.1fx rt  %5.3fx float\n", scenario.name,
+						rate, blockSize, best.sampleSize, best.seconds * 1.0e9 / (double)best.frames,
+						((double)best.frames / rate) / best.seconds, best.vsFloat);
+				}
+			}
+		}
+	}
+
+	FILE* out = outPath ? fopen (outPath, "w") : stdout;
+	if (!out)
+	{
+		fprintf (stderr, "cannot write %s\n", outPath);
+		return 1;
+	}
+	writeJson (out, results, seconds, repeat, compressed);
+	if (outPath)
+		fclose (out);
+	return 0;
+}
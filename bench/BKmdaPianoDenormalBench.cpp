@@ -0,0 +1,204 @@
+/*
+ *  BKmdaPianoDenormalBench.cpp
+ *  mda-vst3
+ *
+ *  次正规数基准：和 BKmdaPianoBench 一样用 SDK 的 hosting 辅助类驱动 PianoProcessor，
+ *  踩住延音踏板弹一个 32 音的和弦，松开琴键后一直渲染到所有声部被 retireVoices 移除，再多渲染 2 秒静音，
+ *  让延迟线和滤波器状态也放完。只对 process () 计时，按尾巴的每一秒输出活跃声部数、每块平均和最大耗时，
+ *  以及这一秒里见到的次正规数：块尾活跃声部的 env / f0 / f1，和主输出的采样。
+ *
+ *  处理器只渲染 env >= SILENCE (1e-4) 的声部，延迟线没有反馈，所以正常的尾巴本来就到不了次正规数区间；
+ *  这个基准看的是实际的尾巴上有没有尖峰，而不是人为构造的次正规状态有多慢。
+ *  要和没有保护时比较，用 -DMDA_PIANO_DENORMAL_GUARD=0 再编译一份（不开 FTZ/DAZ，也不清滤波器和延迟线的状态）。
+ *
+ *  c++ -O2 -std=c++17 -I.. -I<vst3sdk> BKmdaPianoDenormalBench.cpp ../BKmdaPiano*.cpp ../mdaPianoController.cpp <sdk sources> -lpthread
+ *
+ *  用法：BKmdaPianoDenormalBench [--seconds s] [-r rate] [-b frames]
+ *
+ */
+
+#include "BKmdaPianoProcessor.h"
+#include "mdaPianoController.h"
+#include "public.sdk/source/vst/hosting/eventlist.h"
+#include "public.sdk/source/vst/hosting/parameterchanges.h"
+#include "public.sdk/source/vst/hosting/processdata.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef MDA_PIANO_DENORMAL_GUARD
+#define MDA_PIANO_DENORMAL_GUARD 1	//must match how ../BKmdaPianoProcessor.cpp was compiled
+#endif
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+using namespace Steinberg::Vst::mda;
+
+namespace {
+
+enum {
+	kPolyParam = 8,	//polyphony, normalized
+	kChordNotes = 32,
+	kMaxEventsPerBlock = 1024
+};
+
+//-----------------------------------------------------------------------------
+struct BenchProcessor : PianoProcessor
+{
+	int32 getActiveVoices () const { return synthData.activevoices; }
+
+	// 块尾活跃声部里 env、f0、f1 是次正规数的个数
+	int32 countSubnormalVoiceState () const
+	{
+		int32 count = 0;
+		for (int32 v = 0; v < synthData.activevoices; v++)
+		{
+			const VOICE& V = synthData.voice[v];
+			for (float x : {V.env, V.f0, V.f1})
+				if (std::fpclassify (x) == FP_SUBNORMAL) count++;
+		}
+		return count;
+	}
+};
+
+//-----------------------------------------------------------------------------
+struct Second
+{
+	int32 blocks = 0;
+	int32 maxVoices = 0;
+	int64 subnormalStates = 0;
+	int64 subnormalSamples = 0;
+	double sumNs = 0.0;
+	double maxNs = 0.0;
+};
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+int main (int argc, char** argv)
+{
+	double seconds = 120.0;	//longest tail rendered
+	double rate = 44100.0;
+	int32 blockSize = 64;
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (!strcmp (argv[i], "--seconds") && hasValue) seconds = atof (argv[++i]);
+		else if (!strcmp (argv[i], "-r") && hasValue) rate = atof (argv[++i]);
+		else if (!strcmp (argv[i], "-b") && hasValue) blockSize = std::max (1, atoi (argv[++i]));
+		else
+		{
+			fprintf (stderr, "usage: BKmdaPianoDenormalBench [--seconds s] [-r rate] [-b frames]\n");
+			return 2;
+		}
+	}
+
+	BenchProcessor* processor = new BenchProcessor;
+	processor->initialize (nullptr);
+	ProcessSetup setup {kRealtime, kSample32, blockSize, rate};
+	processor->setupProcessing (setup);
+	processor->setActive (true);
+	processor->setProcessing (true);
+
+	HostProcessData data;
+	data.prepare (*processor, blockSize, kSample32);
+	EventList eventList (kMaxEventsPerBlock);
+	ParameterChanges paramChanges (4);
+	data.inputEvents = &eventList;
+	data.inputParameterChanges = &paramChanges;
+
+	//第一块：全复音、踩下踏板、按下和弦；0.1 秒后松开琴键，踏板一直踩着
+	int64 releaseFrame = (int64)(0.1 * rate);
+	int64 maxFrames = (int64)(seconds * rate);
+	int64 silentFrames = (int64)(2.0 * rate);
+	int64 tailEnd = -1;	//frame the last voice was retired
+	std::vector<Second> bins;
+
+	for (int64 frame = 0; frame < maxFrames && (tailEnd < 0 || frame < tailEnd + silentFrames); frame += blockSize)
+	{
+		eventList.clear ();
+		paramChanges.clearQueue ();
+		int32 index, point;
+		for (int32 i = 0; i < kChordNotes; i++)
+		{
+			int32 pitch = 28 + (i * 67) % 72;	//same spread as BKmdaPianoBench chord32
+			Event e {};
+			if (frame == 0)
+			{
+				e.type = Event::kNoteOnEvent;
+				e.noteOn.pitch = (int16)pitch;  e.noteOn.velocity = 0.5f + 0.015f * i;  e.noteOn.noteId = i;
+			}
+			else if (frame <= releaseFrame && releaseFrame < frame + blockSize)
+			{
+				e.sampleOffset = (int32)(releaseFrame - frame);
+				e.type = Event::kNoteOffEvent;
+				e.noteOff.pitch = (int16)pitch;  e.noteOff.noteId = i;
+			}
+			else
+				continue;
+			eventList.addEvent (e);
+		}
+		if (frame == 0)
+		{
+			paramChanges.addParameterData (kPolyParam, index)->addPoint (0, 1.0, point);
+			paramChanges.addParameterData (BaseController::kSustainParam, index)->addPoint (0, 1.0, point);
+		}
+
+		data.numSamples = blockSize;
+		auto t0 = std::chrono::steady_clock::now ();
+		processor->process (data);
+		double ns = std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now () - t0).count ();
+
+		size_t s = (size_t)((double)frame / rate);
+		if (s >= bins.size ()) bins.resize (s + 1);
+		Second& bin = bins[s];
+		bin.blocks++;
+		bin.sumNs += ns;
+		bin.maxNs = std::max (bin.maxNs, ns);
+		bin.maxVoices = std::max (bin.maxVoices, processor->getActiveVoices ());
+		bin.subnormalStates += processor->countSubnormalVoiceState ();
+		for (int32 c = 0; c < 2; c++)
+			for (int32 f = 0; f < blockSize; f++)
+				if (std::fpclassify (data.outputs[0].channelBuffers32[c][f]) == FP_SUBNORMAL) bin.subnormalSamples++;
+
+		if (tailEnd < 0 && frame > releaseFrame && processor->getActiveVoices () == 0)
+			tailEnd = frame;
+	}
+
+	printf ("kernel: %s, guard %s, %d-note pedal tail at %.0f Hz, %d frames/block\n",
+		getVoiceKernelName (getVoiceKernel ()), MDA_PIANO_DENORMAL_GUARD ? "on" : "off", (int)kChordNotes, rate, blockSize);
+	printf ("%6s %6s %12s %12s %10s %10s\n", "second", "voices", "mean ns", "max ns", "subn.state", "subn.out");
+	Second total;
+	double worstMean = 0.0;
+	for (size_t s = 0; s < bins.size (); s++)
+	{
+		const Second& b = bins[s];
+		double mean = b.blocks > 0 ? b.sumNs / b.blocks : 0.0;
+		printf ("%6d %6d %12.0f %12.0f %10lld %10lld\n", (int)s, b.maxVoices, mean, b.maxNs,
+			(long long)b.subnormalStates, (long long)b.subnormalSamples);
+		if (s > 0) worstMean = std::max (worstMean, mean);	//second 0 includes the note-ons
+		total.blocks += b.blocks;
+		total.sumNs += b.sumNs;
+		total.maxNs = std::max (total.maxNs, b.maxNs);
+		total.subnormalStates += b.subnormalStates;
+		total.subnormalSamples += b.subnormalSamples;
+	}
+	double mean = total.blocks > 0 ? total.sumNs / total.blocks : 0.0;
+	printf ("tail %s after %.1f s; mean %.0f ns/block, worst second %.0f ns/block (%.2fx), max %.0f ns; "
+		"subnormal voice states %lld, subnormal output samples %lld\n",
+		tailEnd >= 0 ? "retired" : "still sounding", (tailEnd >= 0 ? tailEnd : maxFrames) / rate,
+		mean, worstMean, mean > 0.0 ? worstMean / mean : 0.0, total.maxNs,
+		(long long)total.subnormalStates, (long long)total.subnormalSamples);
+
+	processor->setProcessing (false);
+	processor->setActive (false);
+	processor->terminate ();
+	processor->release ();
+	data.unprepare ();
+	return 0;
+}
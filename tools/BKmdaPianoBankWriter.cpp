@@ -0,0 +1,116 @@
+/*
+ *  BKmdaPianoBankWriter.cpp
+ *  mda-vst3
+ *
+ *  生成外部音色库文件（格式见 BKmdaPianoSampleBank.h）。
+ *  不带输入参数时把编译进来的 pianoData 和内置键组表写成音色库；
+ *  也可以从 16 位小端裸 PCM 加一个键组表文本生成新的音色库，换音色不需要重新编译插件。
+ *
+ *  用法：
+ *    BKmdaPianoBankWriter <output.bank>
+ *    BKmdaPianoBankWriter <output.bank> <samples.raw> <keygroups.txt> [sample rate]
+ *
+ *  键组表每行一个键组：root high pos end loop，# 开头为注释。
+ *  写完后重新映射一次做校验。
+ *
+ */
+
+#include "BKmdaPianoBuiltinBank.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Steinberg;
+using namespace Steinberg::Vst::mda;
+
+namespace {
+
+//-----------------------------------------------------------------------------
+static bool readSamples (const char* path, std::vector<short>& samples)
+{
+	std::ifstream file (path, std::ios::binary);
+	if (!file)
+		return false;
+	std::vector<char> bytes ((std::istreambuf_iterator<char> (file)), std::istreambuf_iterator<char> ());
+	samples.resize (bytes.size () / 2);
+	for (size_t i = 0; i < samples.size (); i++)
+		samples[i] = (short)((uint8)bytes[2 * i] | ((uint8)bytes[2 * i + 1] << 8));
+	return !samples.empty ();
+}
+
+//-----------------------------------------------------------------------------
+static bool readKeygroups (const char* path, std::vector<SampleBankKeygroup>& keygroups)
+{
+	std::ifstream file (path);
+	if (!file)
+		return false;
+	std::string line;
+	while (std::getline (file, line))
+	{
+		size_t hash = line.find ('#');
+		if (hash != std::string::npos) line.erase (hash);
+		std::istringstream in (line);
+		SampleBankKeygroup g;
+		if (in >> g.root >> g.high >> g.pos >> g.end >> g.loop)
+			keygroups.push_back (g);
+	}
+	return !keygroups.empty ();
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+int main (int argc, char** argv)
+{
+	if (argc != 2 && argc != 4 && argc != 5)
+	{
+		fprintf (stderr, "usage: BKmdaPianoBankWriter <output.bank> [<samples.raw> <keygroups.txt> [sample rate]]\n");
+		return 2;
+	}
+
+	std::vector<short> samples;
+	std::vector<SampleBankKeygroup> keygroups;
+	uint32 sampleRate = kBuiltinSampleRate;
+	if (argc == 2)
+	{
+		samples.assign (pianoData, pianoData + sizeof (pianoData) / sizeof (pianoData[0]));
+		keygroups.assign (builtinKeygroups, builtinKeygroups + sizeof (builtinKeygroups) / sizeof (builtinKeygroups[0]));
+	}
+	else
+	{
+		if (!readSamples (argv[2], samples))
+		{
+			fprintf (stderr, "cannot read samples from %s\n", argv[2]);
+			return 1;
+		}
+		if (!readKeygroups (argv[3], keygroups))
+		{
+			fprintf (stderr, "cannot read keygroups from %s\n", argv[3]);
+			return 1;
+		}
+		if (argc == 5)
+			sampleRate = (uint32)atoi (argv[4]);
+	}
+
+	std::string error;
+	if (!SampleBank::write (argv[1], samples.data (), (uint32)samples.size (), sampleRate,
+	                        keygroups.data (), (int32)keygroups.size (), &error))
+	{
+		fprintf (stderr, "%s\n", error.c_str ());
+		return 1;
+	}
+
+	SampleBank* bank = SampleBank::acquire (argv[1], &error);
+	if (!bank)
+	{
+		fprintf (stderr, "written bank does not load: %s\n", error.c_str ());
+		return 1;
+	}
+	printf ("%s: %d keygroups, %u samples at %u Hz\n", argv[1], bank->getNumKeygroups (), bank->getNumSamples (), bank->getSampleRate ());
+	bank->release ();
+	return 0;
+}
@@ -0,0 +1,692 @@
+/*
+ *  BKmdaPianoRender.cpp
+ *  mda-vst3
+ *
+ *  离线渲染命令行工具：不经过 VST3 宿主，直接用 SDK 的 hosting 辅助类（HostProcessData、EventList、
+ *  ParameterChanges）驱动 PianoProcessor，把 MIDI 文件或事件列表渲染成 16/24/32/64 位 WAV。
+ *  和插件用的是同一份 DSP 代码，用来做回归渲染；ToWav2.py 只保留作阅读声部算法时的参考。
+ *
+ *  编译时与 BKmdaPiano*.cpp、mdaPianoController.cpp（提供 uid）、VST3 SDK 的 base/pluginterfaces/
+ *  public.sdk（audioeffect、hosting/processdata、hosting/eventlist、hosting/parameterchanges）一起链接。
+ *
+ *  用法：
+ *    BKmdaPianoRender [options] <input.mid | input.txt> <output.wav>
+ *    BKmdaPianoRender --batch jobs.txt [-j threads]
+ *
+ *  options:
+ *    -r <rate>          sample rate (44100)
+ *    -b <frames>        block size (512)
+ *    -w <16|24|32|64>   output bits, 32/64 = float (24)
+ *    -p <program>       program 0-7 (0)
+ *    -P <index>=<value> normalized parameter 0-11, may repeat
+ *    -t <seconds>       max tail after the last event (3)
+ *    --stats            print per-block telemetry (p50/p99/max) after rendering
+ *    --trace <file>     record the processor's input for BKmdaPianoReplay
+ *
+ *  事件列表每行一个事件，时间单位为秒，# 开头为注释：
+ *    <time> on <pitch> <velocity 0-127>
+ *    <time> off <pitch>
+ *    <time> sustain <0-127>
+ *    <time> modwheel <0-127>
+ *    <time> param <index> <value 0-1>
+ *
+ *  batch 文件每行是一组完整的命令行参数（options input output），各任务用独立的处理器实例并行渲染。
+ *
+ */
+
+#include "BKmdaPianoProcessor.h"
+#include "mdaPianoController.h"
+#include "BKmdaPianoWavWriter.h"
+#include "public.sdk/source/vst/hosting/eventlist.h"
+#include "public.sdk/source/vst/hosting/parameterchanges.h"
+#include "public.sdk/source/vst/hosting/processdata.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+using namespace Steinberg::Vst::mda;
+
+namespace {
+
+enum {
+	kNumPrograms = 8,	//PianoProcessor::kNumPrograms
+	kNumParams = 12,
+	kMaxEventsPerBlock = 1024
+};
+
+static const float kSilenceLevel = 1.0e-6f;	//-120 dB
+static const double kSilenceHold = 0.25;	//tail ends after this long below kSilenceLevel
+
+//-----------------------------------------------------------------------------
+struct RenderJob
+{
+	std::string input;
+	std::string output;
+	double sampleRate = 44100.0;
+	int32 blockSize = 512;
+	int32 bits = 24;
+	int32 program = 0;
+	std::vector<std::pair<int32, double>> params;
+	double tail = 3.0;
+	bool stats = false;
+	std::string trace;
+};
+
+//-----------------------------------------------------------------------------
+struct TimedEvent
+{
+	enum Kind { kNoteOn, kNoteOff, kParam };
+
+	double time;	//seconds
+	int32 order;	//keeps the file order for events at the same time
+	Kind kind;
+	int16 channel;
+	int16 pitch;
+	float velocity;
+	ParamID id;
+	ParamValue value;
+};
+
+typedef std::vector<TimedEvent> EventTimeline;
+
+//-----------------------------------------------------------------------------
+static void addNote (EventTimeline& events, double time, TimedEvent::Kind kind, int16 channel, int16 pitch, float velocity)
+{
+	TimedEvent e {};
+	e.time = time;  e.order = (int32)events.size ();  e.kind = kind;
+	e.channel = channel;  e.pitch = pitch;  e.velocity = velocity;
+	events.push_back (e);
+}
+
+static void addParam (EventTimeline& events, double time, ParamID id, ParamValue value)
+{
+	TimedEvent e {};
+	e.time = time;  e.order = (int32)events.size ();  e.kind = TimedEvent::kParam;
+	e.id = id;  e.value = std::min (1.0, std::max (0.0, value));
+	events.push_back (e);
+}
+
+static ParamValue programValue (int32 program)
+{
+	return (program + 0.5) / kNumPrograms;	//center of the program's range for kPresetParam
+}
+
+//-----------------------------------------------------------------------------
+// Standard MIDI File (format 0/1)。所有音轨合并，按 tempo map 换算成秒；只取音符、CC1、CC64 和 program change
+class MidiReader
+{
+public:
+	bool load (const std::string& path, EventTimeline& events, std::string& error)
+	{
+		std::ifstream file (path, std::ios::binary);
+		data.assign (std::istreambuf_iterator<char> (file), std::istreambuf_iterator<char> ());
+		pos = 0;
+		if (data.size () < 14 || memcmp (&data[0], "MThd", 4) != 0)
+			return fail (error, "not a MIDI file");
+
+		pos = 8;
+		uint32 format = read16 ();
+		uint32 numTracks = read16 ();
+		uint32 division = read16 ();
+		if (division & 0x8000)
+			return fail (error, "SMPTE time division is not supported");
+		if (format > 1)
+			return fail (error, "MIDI format 2 is not supported");
+		pos = 8 + read32At (4);
+
+		struct RawEvent { uint64 tick; int32 order; uint8 status, a, b; uint32 tempo; };
+		std::vector<RawEvent> raw;
+		for (uint32 t = 0; t < numTracks; t++)
+		{
+			if (pos + 8 > data.size () || memcmp (&data[pos], "MTrk", 4) != 0)
+				return fail (error, "bad track header");
+			size_t end = pos + 8 + read32At (pos + 4);
+			if (end > data.size ())
+				return fail (error, "truncated track");
+			pos += 8;
+
+			uint64 tick = 0;
+			uint8 running = 0;
+			while (pos < end)
+			{
+				tick += readVarLen ();
+				if (pos + 2 >= end)
+					break;	//end of track padding
+				uint8 status = data[pos];
+				if (status & 0x80) pos++;
+				else status = running;	//running status
+
+				if (status == 0xFF)
+				{
+					uint8 type = data[pos++];
+					uint32 len = readVarLen ();
+					if (pos + len > end)
+						return fail (error, "truncated meta event");
+					if (type == 0x51 && len == 3)
+						raw.push_back ({tick, (int32)raw.size (), 0xFF, 0, 0, (uint32)((data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2])});
+					pos += len;
+				}
+				else if (status == 0xF0 || status == 0xF7)
+					pos += readVarLen ();
+				else if (status & 0x80)
+				{
+					running = status;
+					uint8 a = data[pos++], b = 0;
+					if ((status & 0xE0) != 0xC0)	//program change and channel pressure have one data byte
+						b = data[pos++];
+					raw.push_back ({tick, (int32)raw.size (), status, a, b, 0});
+				}
+				else
+					return fail (error, "bad running status");
+			}
+			pos = end;
+		}
+
+		std::stable_sort (raw.begin (), raw.end (), [] (const RawEvent& x, const RawEvent& y) { return x.tick < y.tick; });
+
+		//tick -> 秒：每段 tempo 内线性
+		double seconds = 0.0, secondsPerTick = 0.5 / division;	//120 bpm until the first tempo event
+		uint64 lastTick = 0;
+		for (const RawEvent& r : raw)
+		{
+			seconds += (r.tick - lastTick) * secondsPerTick;
+			lastTick = r.tick;
+			int16 channel = r.status & 0x0F;
+			switch (r.status & 0xF0)
+			{
+				case 0xF0:
+					secondsPerTick = r.tempo * 1.0e-6 / division;
+					break;
+				case 0x90:	//note-on with velocity 0 is a note-off
+				case 0x80:
+					if ((r.status & 0xF0) == 0x90 && r.b > 0)
+						addNote (events, seconds, TimedEvent::kNoteOn, channel, r.a, r.b / 127.0f);
+					else
+						addNote (events, seconds, TimedEvent::kNoteOff, channel, r.a, 0.0f);
+					break;
+				case 0xB0:
+					if (r.a == 64) addParam (events, seconds, BaseController::kSustainParam, r.b / 127.0);
+					else if (r.a == 1) addParam (events, seconds, BaseController::kModWheelParam, r.b / 127.0);
+					break;
+				case 0xC0:
+					addParam (events, seconds, BaseController::kPresetParam, programValue (r.a % kNumPrograms));
+					break;
+			}
+		}
+		return true;
+	}
+
+private:
+	bool fail (std::string& error, const char* message) { error = message; return false; }
+	uint32 read16 () { uint32 v = (data[pos] << 8) | data[pos + 1]; pos += 2; return v; }
+	uint32 read32At (size_t p) const { return ((uint32)data[p] << 24) | (data[p + 1] << 16) | (data[p + 2] << 8) | data[p + 3]; }
+	uint32 readVarLen ()
+	{
+		uint32 v = 0;
+		for (int32 i = 0; i < 4 && pos < data.size (); i++)
+		{
+			uint8 c = data[pos++];
+			v = (v << 7) | (c & 0x7F);
+			if (!(c & 0x80)) break;
+		}
+		return v;
+	}
+
+	std::vector<uint8> data;
+	size_t pos = 0;
+};
+
+//-----------------------------------------------------------------------------
+static bool loadEventList (const std::string& path, EventTimeline& events, std::string& error)
+{
+	std::ifstream file (path);
+	if (!file)
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+	std::string line;
+	for (int32 lineNumber = 1; std::getline (file, line); lineNumber++)
+	{
+		size_t hash = line.find ('#');
+		if (hash != std::string::npos) line.erase (hash);
+		std::istringstream in (line);
+		double time;
+		std::string kind;
+		if (!(in >> time))
+			continue;	//blank line
+		in >> kind;
+
+		double a = 0.0, b = 0.0;
+		bool ok = true;
+		if (kind == "on") { ok = (bool)(in >> a >> b);  addNote (events, time, TimedEvent::kNoteOn, 0, (int16)a, (float)(b / 127.0)); }
+		else if (kind == "off") { ok = (bool)(in >> a);  addNote (events, time, TimedEvent::kNoteOff, 0, (int16)a, 0.0f); }
+		else if (kind == "sustain") { ok = (bool)(in >> a);  addParam (events, time, BaseController::kSustainParam, a / 127.0); }
+		else if (kind == "modwheel") { ok = (bool)(in >> a);  addParam (events, time, BaseController::kModWheelParam, a / 127.0); }
+		else if (kind == "param") { ok = (bool)(in >> a >> b) && a >= 0 && a < kNumParams;  addParam (events, time, (ParamID)a, b); }
+		else ok = false;
+
+		if (!ok)
+		{
+			error = path + ":" + std::to_string (lineNumber) + ": cannot parse '" + line + "'";
+			return false;
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static bool endsWith (const std::string& s, const char* suffix)
+{
+	size_t n = strlen (suffix);
+	if (s.size () < n)
+		return false;
+	for (size_t i = 0; i < n; i++)
+		if (tolower (s[s.size () - n + i]) != suffix[i]) return false;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static bool renderJob (const RenderJob& job, std::string& report)
+{
+	EventTimeline timeline;
+	std::string error;
+	bool loaded = endsWith (job.input, ".mid") || endsWith (job.input, ".midi") ?
+		MidiReader ().load (job.input, timeline, error) : loadEventList (job.input, timeline, error);
+	if (!loaded)
+	{
+		report = job.input + ": " + error;
+		return false;
+	}
+	std::stable_sort (timeline.begin (), timeline.end (), [] (const TimedEvent& a, const TimedEvent& b) {
+		return a.time < b.time || (a.time == b.time && a.order < b.order);
+	});
+
+	PianoProcessor* processor = new PianoProcessor;
+	processor->initialize (nullptr);
+	ProcessSetup setup {kOffline, kSample32, job.blockSize, job.sampleRate};
+	processor->setupProcessing (setup);
+
+	//录制要在 setActive 之前打开，记录从 setActive 开始
+	FILE* traceFile = nullptr;
+	if (!job.trace.empty ())
+	{
+		traceFile = fopen (job.trace.c_str (), "wb");
+		if (!traceFile)
+		{
+			report = "cannot write " + job.trace;
+			processor->terminate ();
+			processor->release ();
+			return false;
+		}
+		processor->getTraceRecorder ().setEnabled (true);
+	}
+	processor->setActive (true);
+	processor->setProcessing (true);
+	processor->getTelemetry ().setEnabled (job.stats);
+	TelemetrySummary summary;
+
+	HostProcessData data;
+	data.prepare (*processor, job.blockSize, kSample32);
+	EventList eventList (kMaxEventsPerBlock);
+	ParameterChanges paramChanges (kNumParams + 8);
+	ProcessContext context {};
+	context.sampleRate = job.sampleRate;
+	data.inputEvents = &eventList;
+	data.inputParameterChanges = &paramChanges;
+	data.processContext = &context;
+	data.processMode = kOffline;
+
+	WavWriter wav;
+	if (!wav.open (job.output, job.sampleRate, job.bits))
+	{
+		report = "cannot write " + job.output;
+		processor->setActive (false);
+		processor->terminate ();
+		processor->release ();
+		if (traceFile)
+			fclose (traceFile);
+		return false;
+	}
+
+	//note-off 找同一通道同一音高最早按下的 noteId
+	std::map<int32, std::vector<int32>> held;
+	int32 nextNoteId = 0;
+
+	int64 lastEventFrame = timeline.empty () ? 0 : (int64)(timeline.back ().time * job.sampleRate);
+	int64 endFrame = lastEventFrame + (int64)(job.tail * job.sampleRate);
+	int64 silentFrames = 0, holdFrames = (int64)(kSilenceHold * job.sampleRate);
+	size_t next = 0;
+	int64 frame = 0;
+
+	auto t0 = std::chrono::steady_clock::now ();
+	while (frame < endFrame)
+	{
+		int32 n = (int32)std::min<int64> (job.blockSize, endFrame - frame);
+		eventList.clear ();
+		paramChanges.clearQueue ();
+
+		if (frame == 0)
+		{
+			int32 index;
+			paramChanges.addParameterData (BaseController::kPresetParam, index)->addPoint (0, programValue (job.program), index);
+			for (const auto& p : job.params)
+				paramChanges.addParameterData ((ParamID)p.first, index)->addPoint (0, p.second, index);
+		}
+
+		for (; next < timeline.size (); next++)
+		{
+			const TimedEvent& t = timeline[next];
+			int64 at = (int64)(t.time * job.sampleRate);
+			if (at >= frame + n)
+				break;
+			int32 offset = (int32)std::max<int64> (0, at - frame);
+
+			if (t.kind == TimedEvent::kParam)
+			{
+				int32 index, point;
+				IParamValueQueue* queue = paramChanges.addParameterData (t.id, index);
+				if (queue)
+					queue->addPoint (offset, t.value, point);
+				continue;
+			}
+
+			Event e {};
+			e.sampleOffset = offset;
+			e.flags = Event::kIsLive;
+			std::vector<int32>& ids = held[(t.channel << 8) | t.pitch];
+			if (t.kind == TimedEvent::kNoteOn)
+			{
+				e.type = Event::kNoteOnEvent;
+				e.noteOn.channel = t.channel;  e.noteOn.pitch = t.pitch;  e.noteOn.velocity = t.velocity;
+				e.noteOn.noteId = nextNoteId++;
+				ids.push_back (e.noteOn.noteId);
+			}
+			else
+			{
+				if (ids.empty ())
+					continue;	//stray note-off
+				e.type = Event::kNoteOffEvent;
+				e.noteOff.channel = t.channel;  e.noteOff.pitch = t.pitch;
+				e.noteOff.noteId = ids.front ();
+				ids.erase (ids.begin ());
+			}
+			eventList.addEvent (e);
+		}
+
+		data.numSamples = n;
+		context.projectTimeSamples = frame;
+		processor->process (data);
+		if (job.stats)
+			summary.collect (processor->getTelemetry ());	//同一线程在两次 process () 之间读，仍然是单生产者单消费者
+		if (traceFile)
+			processor->getTraceRecorder ().flush (traceFile);
+
+		float* l = data.outputs[0].channelBuffers32[0];
+		float* r = data.outputs[0].channelBuffers32[1];
+		wav.write (l, r, n);
+		frame += n;
+
+		//最后一个事件之后输出持续静音就提前结束
+		float peak = 0.0f;
+		for (int32 f = 0; f < n; f++)
+			peak = std::max (peak, std::max (std::fabs (l[f]), std::fabs (r[f])));
+		silentFrames = peak < kSilenceLevel ? silentFrames + n : 0;
+		if (frame > lastEventFrame && next == timeline.size () && silentFrames >= holdFrames)
+			break;
+	}
+	double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - t0).count ();
+	uint64 dropped = processor->getTelemetry ().getDropped ();
+	uint64 traceDropped = processor->getTraceRecorder ().getDropped ();
+	uint64 controlOverflows = processor->getControlOverflows ();
+	bool traceOk = true;
+	if (traceFile)
+	{
+		traceOk = processor->getTraceRecorder ().flush (traceFile);
+		traceOk = fclose (traceFile) == 0 && traceOk;
+	}
+
+	processor->setProcessing (false);
+	processor->setActive (false);
+	processor->terminate ();
+	processor->release ();
+	data.unprepare ();
+
+	if (!wav.close ())
+	{
+		report = "error writing " + job.output;
+		return false;
+	}
+
+	char line[512];
+	double audio = frame / job.sampleRate;
+	snprintf (line, sizeof (line), "%s: %.2f s of audio in %.3f s (%.0fx real-time)",
+		job.output.c_str (), audio, seconds, seconds > 0.0 ? audio / seconds : 0.0);
+	report = line;
+	if (!traceOk)
+		report += "\nerror writing " + job.trace;
+	else if (traceDropped)
+	{
+		snprintf (line, sizeof (line), "\n%s: %llu records dropped", job.trace.c_str (), (unsigned long long)traceDropped);
+		report += line;
+	}
+	if (controlOverflows)
+	{
+		snprintf (line, sizeof (line), "\n%s: %llu parameter changes applied early (queue full)", job.output.c_str (),
+			(unsigned long long)controlOverflows);
+		report += line;
+	}
+	if (job.stats)
+	{
+		report += "\n" + summary.format (dropped);
+		report.pop_back ();	//trailing newline, the caller adds one
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static bool parseJob (const std::vector<std::string>& args, RenderJob& job, std::string& error)
+{
+	std::vector<std::string> files;
+	for (size_t i = 0; i < args.size (); i++)
+	{
+		const std::string& a = args[i];
+		bool hasValue = i + 1 < args.size ();
+		if (a == "--stats")
+			job.stats = true;
+		else if (a == "--trace" && hasValue)
+			job.trace = args[++i];
+		else if (a.size () == 2 && a[0] == '-' && strchr ("rbwpPt", a[1]))
+		{
+			if (!hasValue)
+			{
+				error = "missing value for " + a;
+				return false;
+			}
+			const std::string& v = args[++i];
+			switch (a[1])
+			{
+				case 'r': job.sampleRate = atof (v.c_str ()); break;
+				case 'b': job.blockSize = atoi (v.c_str ()); break;
+				case 'w': job.bits = atoi (v.c_str ()); break;
+				case 'p': job.program = atoi (v.c_str ()); break;
+				case 't': job.tail = atof (v.c_str ()); break;
+				case 'P':
+				{
+					size_t eq = v.find ('=');
+					int32 index = eq == std::string::npos ? -1 : atoi (v.c_str ());
+					if (index < 0 || index >= kNumParams)
+					{
+						error = "bad parameter '" + v + "', expected <0-11>=<value>";
+						return false;
+					}
+					job.params.push_back ({index, atof (v.c_str () + eq + 1)});
+					break;
+				}
+			}
+		}
+		else if (!a.empty () && a[0] == '-')
+		{
+			error = "unknown option " + a;
+			return false;
+		}
+		else
+			files.push_back (a);
+	}
+
+	if (files.size () != 2)
+		error = "expected <input> <output.wav>";
+	else if (job.sampleRate < 8000.0 || job.sampleRate > 384000.0)
+		error = "sample rate out of range";
+	else if (job.blockSize < 1 || job.blockSize > 8192)
+		error = "block size out of range";
+	else if (!WavWriter::isSupported (job.bits))
+		error = "bits must be 16, 24, 32 or 64";
+	else if (job.program < 0 || job.program >= kNumPrograms)
+		error = "program must be 0-7";
+	if (!error.empty ())
+		return false;
+
+	job.input = files[0];
+	job.output = files[1];
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static std::vector<std::string> splitArgs (const std::string& line)
+{
+	std::vector<std::string> args;
+	std::string current;
+	bool quoted = false, any = false;
+	for (char c : line)
+	{
+		if (c == '"') { quoted = !quoted;  any = true; }
+		else if (!quoted && (c == ' ' || c == '\t' || c == '\r'))
+		{
+			if (any) args.push_back (current);
+			current.clear ();
+			any = false;
+		}
+		else { current += c;  any = true; }
+	}
+	if (any) args.push_back (current);
+	return args;
+}
+
+//-----------------------------------------------------------------------------
+static int usage ()
+{
+	fprintf (stderr,
+		"usage: BKmdaPianoRender [options] <input.mid|input.txt> <output.wav>\n"
+		"       BKmdaPianoRender --batch <jobs.txt> [-j threads]\n"
+		"  -r <rate>          sample rate (44100)\n"
+		"  -b <frames>        block size (512)\n"
+		"  -w <16|24|32|64>   output bits, 32/64 = float (24)\n"
+		"  -p <program>       program 0-7 (0)\n"
+		"  -P <index>=<value> normalized parameter 0-11, may repeat\n"
+		"  -t <seconds>       max tail after the last event (3)\n"
+		"  --stats            print per-block telemetry (p50/p99/max) after rendering\n"
+		"  --trace <file>     record the processor's input for BKmdaPianoReplay\n");
+	return 2;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+int main (int argc, char** argv)
+{
+	std::vector<std::string> args (argv + 1, argv + argc);
+	std::string batchFile;
+	int32 threads = (int32)std::max (1u, std::thread::hardware_concurrency ());
+
+	for (size_t i = 0; i < args.size (); i++)
+	{
+		if (args[i] == "--batch" && i + 1 < args.size ())
+		{
+			batchFile = args[i + 1];
+			args.erase (args.begin () + i, args.begin () + i + 2);
+			i--;
+		}
+		else if (args[i] == "-j" && i + 1 < args.size ())
+		{
+			threads = std::max (1, atoi (args[i + 1].c_str ()));
+			args.erase (args.begin () + i, args.begin () + i + 2);
+			i--;
+		}
+	}
+
+	std::vector<RenderJob> jobs;
+	std::string error;
+	if (batchFile.empty ())
+	{
+		RenderJob job;
+		if (!parseJob (args, job, error))
+		{
+			fprintf (stderr, "%s\n", error.c_str ());
+			return usage ();
+		}
+		jobs.push_back (job);
+	}
+	else
+	{
+		std::ifstream file (batchFile);
+		if (!file)
+		{
+			fprintf (stderr, "cannot open %s\n", batchFile.c_str ());
+			return 1;
+		}
+		std::string line;
+		for (int32 lineNumber = 1; std::getline (file, line); lineNumber++)
+		{
+			std::vector<std::string> jobArgs = splitArgs (line);
+			if (jobArgs.empty () || jobArgs[0][0] == '#')
+				continue;
+			RenderJob job;
+			if (!parseJob (jobArgs, job, error))
+			{
+				fprintf (stderr, "%s:%d: %s\n", batchFile.c_str (), lineNumber, error.c_str ());
+				return 1;
+			}
+			jobs.push_back (job);
+		}
+	}
+
+	//每个任务一个独立的处理器实例，线程之间只共享任务序号和输出锁
+	std::atomic<size_t> nextJob (0);
+	std::atomic<int32> failures (0);
+	std::mutex printMutex;
+	auto worker = [&] () {
+		for (size_t j; (j = nextJob.fetch_add (1)) < jobs.size ();)
+		{
+			std::string report;
+			bool ok = renderJob (jobs[j], report);
+			if (!ok) failures++;
+			std::lock_guard<std::mutex> lock (printMutex);
+			fprintf (ok ? stdout : stderr, "%s\n", report.c_str ());
+		}
+	};
+
+	threads = std::min<int32> (threads, (int32)jobs.size ());
+	std::vector<std::thread> pool;
+	for (int32 t = 1; t < threads; t++)
+		pool.emplace_back (worker);
+	worker ();
+	for (auto& t : pool)
+		t.join ();
+
+	return failures > 0 ? 1 : 0;
+}
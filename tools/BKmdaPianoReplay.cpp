@@ -0,0 +1,436 @@
+/*
+ *  BKmdaPianoReplay.cpp
+ *  mda-vst3
+ *
+ *  重放 TraceRecorder 录下的记录（BKmdaPianoTrace.h，插件里 getTraceRecorder ().setEnabled (true)，
+ *  或 BKmdaPianoRender --trace）。不经过宿主，每段按录下来的采样率和各声部组合的参数启动一个 PianoProcessor，
+ *  再逐块送入录下来的事件和参数变化，块长、采样精度、输出总线和自适应复音的上限都和录制时相同，
+ *  所以主输出和录制时逐位相同（要求同样的编译选项：MDA_PIANO_NUM_PARTS、MDA_PIANO_NUM_VOICES、
+ *  MDA_PIANO_MIP_LEVELS 等，以及同一个音色库 MDA_PIANO_SAMPLE_BANK；和 trace 里记下的不一致时拒绝重放）。每块的耗时和录制时的耗时一起写进 CSV，用来离线重现和分析现场的 xrun。
+ *
+ *  编译时的链接方式和 BKmdaPianoRender.cpp 相同。
+ *
+ *  用法：
+ *    BKmdaPianoReplay [options] <input.trace> <output.wav>
+ *
+ *  options:
+ *    -w <16|24|32|64>   output bits, 32/64 = float (32, 64 for traces recorded with 64-bit buffers)
+ *    -j <threads>       voice render threads (as recorded); the output does not depend on it
+ *    --blocks <file>    per-block CSV: recorded and replayed render time, events, voices
+ *    --stats            print per-block telemetry (p50/p99/max) after replaying
+ *
+ */
+
+#include "BKmdaPianoProcessor.h"
+#include "mdaPianoController.h"
+#include "BKmdaPianoWavWriter.h"
+#include "public.sdk/source/vst/hosting/eventlist.h"
+#include "public.sdk/source/vst/hosting/processdata.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Steinberg;
+using namespace Steinberg::Vst;
+using namespace Steinberg::Vst::mda;
+
+namespace {
+
+enum {
+	kMaxEventsPerBlock = 1024
+};
+
+//-----------------------------------------------------------------------------
+struct ReplayOptions
+{
+	std::string input;
+	std::string output;
+	std::string blocks;
+	int32 bits = 0;	//0 = from the trace's sample size
+	int32 threads = -1;	//-1 = as recorded
+	bool stats = false;
+};
+
+//-----------------------------------------------------------------------------
+// 顺序读取 trace 里的记录；截断或损坏时停下
+class TraceReader
+{
+public:
+	bool load (const std::string& path)
+	{
+		std::ifstream file (path, std::ios::binary);
+		if (!file)
+			return false;
+		data.assign (std::istreambuf_iterator<char> (file), std::istreambuf_iterator<char> ());
+		pos = 0;
+		return true;
+	}
+
+	bool next (TraceRecord& record, const uint8*& body)
+	{
+		if (pos + sizeof (TraceRecord) > data.size ())
+			return false;
+		memcpy (&record, &data[pos], sizeof (record));
+		if (record.size < sizeof (TraceRecord) || pos + record.size > data.size ())
+			return false;
+		body = &data[pos + sizeof (TraceRecord)];
+		pos += record.size;
+		return true;
+	}
+
+	void rewind () { pos = 0; }
+	bool atEnd () const { return pos == data.size (); }
+
+private:
+	std::vector<uint8> data;
+	size_t pos = 0;
+};
+
+//-----------------------------------------------------------------------------
+// 编译选项或音色库和录制时不同，重放的输出就不再逐位相同
+static bool matchesBuild (const TraceStart& trace, const TraceStart& build, std::string& error)
+{
+	char line[256];
+	if (trace.numVoices != build.numVoices)
+		snprintf (line, sizeof (line), "trace has %d voices, this build has %d (MDA_PIANO_NUM_VOICES)", trace.numVoices, build.numVoices);
+	else if (trace.numMipLevels != build.numMipLevels)
+		snprintf (line, sizeof (line), "trace has %d mip levels, this build has %d (MDA_PIANO_MIP_LEVELS)", trace.numMipLevels, build.numMipLevels);
+	else if (trace.bankSamples != build.bankSamples || trace.bankSampleRate != build.bankSampleRate
+	         || trace.bankChecksum != build.bankChecksum)
+		snprintf (line, sizeof (line), "trace was recorded with another sample bank (%u samples at %u Hz, checksum %08x; "
+			"loaded %u samples at %u Hz, checksum %08x), check MDA_PIANO_SAMPLE_BANK",
+			trace.bankSamples, trace.bankSampleRate, trace.bankChecksum, build.bankSamples, build.bankSampleRate, build.bankChecksum);
+	else
+		return true;
+	error = line;
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// 一段录制（一次 setActive (true) 到下一次）对应一个处理器实例
+class Session
+{
+public:
+	~Session () { stop (); }
+
+	bool start (const TraceStart& header, const uint8* body, const ReplayOptions& options, int32 maxFrames, std::string& error)
+	{
+		stop ();
+		if (header.numParts != PianoProcessor::kNumParts)
+		{
+			char line[128];
+			snprintf (line, sizeof (line), "trace has %d parts, this build has %d", header.numParts, (int32)PianoProcessor::kNumParts);
+			error = line;
+			return false;
+		}
+		rate = header.sampleRate;
+		sampleSize = header.symbolicSampleSize;
+
+		processor = new PianoProcessor;
+		processor->setCompressedSamples (header.compressedSamples != 0);
+		processor->setRenderThreads (options.threads >= 0 ? options.threads : header.renderThreads);
+		processor->initialize (nullptr);
+		TraceStart build = {};
+		processor->getTraceIdentity (build);
+		if (!matchesBuild (header, build, error))
+		{
+			processor->terminate ();
+			processor->release ();
+			processor = nullptr;
+			return false;
+		}
+		ProcessSetup setup {kOffline, sampleSize, std::max (maxFrames, header.maxSamplesPerBlock), rate};
+		processor->setupProcessing (setup);
+
+		//参数和停用时排队的变化在 setActive 里按录制时的顺序生效
+		const TracePart* parts = (const TracePart*)body;
+		for (int32 p = 0; p < header.numParts; p++)
+			processor->setPartState (p, parts[p].program, parts[p].params);
+		const TraceControl* controls = (const TraceControl*)(parts + header.numParts);
+		for (int32 i = 0; i < header.numControls; i++)
+			processor->replayControl (controls[i].part, controls[i].id, controls[i].value, controls[i].sampleOffset);
+		processor->getTelemetry ().setEnabled (true);
+		processor->setActive (true);
+		processor->setProcessing (true);
+
+		data.prepare (*processor, setup.maxSamplesPerBlock, sampleSize);
+		data.inputEvents = &eventList;
+		data.processMode = kOffline;
+		channels.clear ();
+		for (int32 b = 0; b < data.numOutputs; b++)
+			channels.push_back (data.outputs[b].numChannels);
+		lastBlock = 0;
+		return true;
+	}
+
+	void stop ()
+	{
+		if (!processor)
+			return;
+		processor->setProcessing (false);
+		processor->setActive (false);
+		processor->terminate ();
+		processor->release ();
+		processor = nullptr;
+		data.numOutputs = (int32)channels.size ();	//unprepare frees the buffers by these counts
+		for (int32 b = 0; b < data.numOutputs; b++)
+			data.outputs[b].numChannels = channels[b];
+		data.unprepare ();
+	}
+
+	// 一块：返回这一块重放时的统计（telemetry 关闭时 renderNs 为 0）
+	BlockStats process (const TraceBlock& block, const uint8* body, WavWriter& wav)
+	{
+		const TraceNote* notes = (const TraceNote*)body;
+		const TraceControl* early = (const TraceControl*)(notes + block.numEvents);
+		const TraceControl* controls = early + block.numEarlyControls;
+
+		eventList.clear ();
+		for (int32 i = 0; i < block.numEvents; i++)
+		{
+			const TraceNote& n = notes[i];
+			Event e {};
+			e.sampleOffset = n.sampleOffset;
+			e.type = (uint16)n.type;
+			if (n.type == Event::kNoteOnEvent)
+			{
+				e.noteOn.channel = (int16)n.channel;  e.noteOn.pitch = (int16)n.pitch;
+				e.noteOn.velocity = n.velocity;  e.noteOn.noteId = n.noteId;
+			}
+			else
+			{
+				e.noteOff.channel = (int16)n.channel;  e.noteOff.pitch = (int16)n.pitch;
+				e.noteOff.velocity = n.velocity;  e.noteOff.noteId = n.noteId;
+			}
+			eventList.addEvent (e);
+		}
+		//录制时参数队列满了、马上生效的变化先按原来的顺序生效，其余的直接排进处理器的队列，和录制时排好的顺序完全一样
+		for (int32 i = 0; i < block.numEarlyControls; i++)
+			processor->replayEarlyControl (early[i].part, early[i].id, early[i].value);
+		for (int32 i = 0; i < block.numControls; i++)
+			processor->replayControl (controls[i].part, controls[i].id, controls[i].value, controls[i].sampleOffset);
+
+		//自适应复音：录制时开着就用录下来的上限，不按这次的耗时算
+		processor->getVoiceBudget ().setEnabled (block.voiceCap >= 0);
+		processor->setReplayVoiceCap (block.voiceCap);
+
+		//录制时宿主没有给的总线，这里也不给，声部组合照样混进主输出
+		int32 numOutputs = (int32)channels.size ();
+		data.numOutputs = std::min (numOutputs, block.numOutputs);
+		for (int32 b = 1; b < numOutputs; b++)
+			data.outputs[b].numChannels = (block.busMask >> b) & 1 ? channels[b] : 0;
+		data.numSamples = block.frames;
+		processor->process (data);
+
+		if (sampleSize == kSample64)
+			wav.write (data.outputs[0].channelBuffers64[0], data.outputs[0].channelBuffers64[1], block.frames);
+		else
+			wav.write (data.outputs[0].channelBuffers32[0], data.outputs[0].channelBuffers32[1], block.frames);
+
+		BlockStats stats {};
+		processor->getTelemetry ().read (&stats, 1);	//同一线程在两次 process () 之间读
+		lastBlock = block.block;
+		return stats;
+	}
+
+	bool isRunning () const { return processor != nullptr; }
+	uint64 getLastBlock () const { return lastBlock; }
+
+private:
+	PianoProcessor* processor = nullptr;
+	HostProcessData data;
+	EventList eventList {kMaxEventsPerBlock};
+	std::vector<int32> channels;	//as prepared, restored for buses the block had
+	double rate = 44100.0;
+	int32 sampleSize = kSample32;
+	uint64 lastBlock = 0;
+};
+
+//-----------------------------------------------------------------------------
+static bool replay (const ReplayOptions& options, std::string& report)
+{
+	TraceReader reader;
+	if (!reader.load (options.input))
+	{
+		report = "cannot read " + options.input;
+		return false;
+	}
+
+	//先扫一遍：第一段的采样率和精度决定输出文件，最长的块决定缓冲大小
+	TraceRecord record;
+	const uint8* body;
+	const TraceStart* first = nullptr;
+	int32 maxFrames = 0;
+	while (reader.next (record, body))
+	{
+		if (record.type == TraceRecord::kStart && !first)
+			first = (const TraceStart*)body;
+		else if (record.type == TraceRecord::kBlock)
+			maxFrames = std::max (maxFrames, ((const TraceBlock*)body)->frames);
+	}
+	if (!reader.atEnd ())
+		fprintf (stderr, "%s: truncated or damaged after the last whole record\n", options.input.c_str ());
+	if (!first || first->magic != kTraceMagic || first->version != kTraceVersion)
+	{
+		report = options.input + ": not a trace or no start record";
+		return false;
+	}
+
+	int32 bits = options.bits ? options.bits : (first->symbolicSampleSize == kSample64 ? 64 : 32);
+	WavWriter wav;
+	if (!wav.open (options.output, first->sampleRate, bits))
+	{
+		report = "cannot write " + options.output;
+		return false;
+	}
+	FILE* csv = nullptr;
+	if (!options.blocks.empty ())
+	{
+		csv = fopen (options.blocks.c_str (), "w");
+		if (!csv)
+		{
+			report = "cannot write " + options.blocks;
+			return false;
+		}
+		fprintf (csv, "session,block,frames,events,controls,voiceCap,maxVoices,recordedNs,replayNs,eventNs,voiceNs,stereoNs\n");
+	}
+
+	Session session;
+	TelemetrySummary summary;
+	std::string error;
+	int32 sessions = 0;
+	uint64 blocks = 0, frames = 0, gaps = 0, skipped = 0, lost = 0, firstLost = 0;
+	double seconds = 0.0;
+	reader.rewind ();
+	while (reader.next (record, body))
+	{
+		if (record.type == TraceRecord::kStart)
+		{
+			const TraceStart& start = *(const TraceStart*)body;
+			if (start.magic != kTraceMagic || start.version != kTraceVersion)
+				break;
+			if (start.sampleRate != first->sampleRate || start.symbolicSampleSize != first->symbolicSampleSize)
+				fprintf (stderr, "session %d has a different sample rate or size, written as if it had the first one's\n", sessions + 1);
+			if (!session.start (start, body + sizeof (TraceStart), options, maxFrames, error))
+			{
+				report = options.input + ": " + error;
+				return false;
+			}
+			sessions++;
+		}
+		else if (record.type == TraceRecord::kBlock)
+		{
+			const TraceBlock& block = *(const TraceBlock*)body;
+			if (!session.isRunning ())
+			{
+				skipped++;	//start record was dropped, nothing to replay from
+				continue;
+			}
+			if (session.getLastBlock () && block.block != session.getLastBlock () + 1)
+				gaps++;
+			auto t0 = std::chrono::steady_clock::now ();
+			BlockStats stats = session.process (block, body + sizeof (TraceBlock), wav);
+			seconds += std::chrono::duration<double> (std::chrono::steady_clock::now () - t0).count ();
+			summary.add (stats);
+			if (csv)
+				fprintf (csv, "%d,%llu,%d,%d,%d,%d,%d,%u,%u,%u,%u,%u\n", sessions, (unsigned long long)block.block, block.frames,
+					block.numEvents, block.numControls, block.voiceCap, stats.maxActiveVoices,
+					block.renderNs, stats.renderNs, stats.eventNs, stats.voiceNs, stats.stereoNs);
+			if (block.lostControls > 0 && lost++ == 0)
+				firstLost = block.block;
+			blocks++;
+			frames += (uint64)block.frames;
+		}
+	}
+	session.stop ();
+	if (csv)
+		fclose (csv);
+	if (!wav.close ())
+	{
+		report = "error writing " + options.output;
+		return false;
+	}
+
+	char line[512];
+	double audio = frames / first->sampleRate;
+	snprintf (line, sizeof (line), "%s: %d session(s), %llu blocks, %.2f s of audio in %.3f s (%.0fx real-time)",
+		options.output.c_str (), sessions, (unsigned long long)blocks, audio, seconds, seconds > 0.0 ? audio / seconds : 0.0);
+	report = line;
+	if (gaps || skipped)
+	{
+		//录制时环满丢掉的块无法重放，之后的输出不再逐位相同
+		snprintf (line, sizeof (line), "\nwarning: %llu gap(s) and %llu block(s) without a start record, the output is not exact after the first one",
+			(unsigned long long)gaps, (unsigned long long)skipped);
+		report += line;
+	}
+	if (lost)
+	{
+		//参数队列满时提前生效的变化太多，录制时没能全部记下
+		snprintf (line, sizeof (line), "\nwarning: %llu block(s) applied parameter changes the trace did not keep, the output is not exact after block %llu",
+			(unsigned long long)lost, (unsigned long long)firstLost);
+		report += line;
+	}
+	if (options.stats)
+	{
+		report += "\n" + summary.format ();
+		report.pop_back ();	//trailing newline, the caller adds one
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static int usage ()
+{
+	fprintf (stderr,
+		"usage: BKmdaPianoReplay [options] <input.trace> <output.wav>\n"
+		"  -w <16|24|32|64>   output bits, 32/64 = float (32, or 64 for 64-bit traces)\n"
+		"  -j <threads>       voice render threads (as recorded)\n"
+		"  --blocks <file>    per-block CSV with recorded and replayed render time\n"
+		"  --stats            print per-block telemetry (p50/p99/max) after replaying\n");
+	return 2;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+int main (int argc, char** argv)
+{
+	ReplayOptions options;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string a = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (a == "--stats")
+			options.stats = true;
+		else if (a == "--blocks" && hasValue)
+			options.blocks = argv[++i];
+		else if (a == "-w" && hasValue)
+			options.bits = atoi (argv[++i]);
+		else if (a == "-j" && hasValue)
+			options.threads = std::max (0, atoi (argv[++i]));
+		else if (!a.empty () && a[0] == '-')
+		{
+			fprintf (stderr, "unknown option %s\n", a.c_str ());
+			return usage ();
+		}
+		else
+			files.push_back (a);
+	}
+	if (files.size () != 2 || (options.bits && !WavWriter::isSupported (options.bits)))
+		return usage ();
+	options.input = files[0];
+	options.output = files[1];
+
+	std::string report;
+	bool ok = replay (options, report);
+	fprintf (ok ? stdout : stderr, "%s\n", report.c_str ());
+	return ok ? 0 : 1;
+}
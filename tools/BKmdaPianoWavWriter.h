@@ -0,0 +1,119 @@
+/*
+ *  BKmdaPianoWavWriter.h
+ *  mda-vst3
+ *
+ *  命令行工具（BKmdaPianoRender、BKmdaPianoReplay）共用的立体声 WAV 输出：16/24 位 PCM，32/64 位浮点。
+ *  边渲染边写盘，数据长度在 close () 时回填到头里。样本按小端写出，与主机字节序无关。
+ *
+ */
+
+#pragma once
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace Steinberg {
+namespace Vst {
+namespace mda {
+
+//-----------------------------------------------------------------------------
+class WavWriter
+{
+public:
+	~WavWriter () { close (); }
+
+	static bool isSupported (int32 bits) { return bits == 16 || bits == 24 || bits == 32 || bits == 64; }
+
+	bool open (const std::string& path, double sampleRate, int32 bitsPerSample)
+	{
+		if (!isSupported (bitsPerSample))
+			return false;
+		file = fopen (path.c_str (), "wb");
+		if (!file)
+			return false;
+		bits = bitsPerSample;
+		dataBytes = 0;
+
+		uint32 rate = (uint32)(sampleRate + 0.5);
+		uint16 format = bits >= 32 ? 3 : 1;	//IEEE float or PCM
+		uint16 channels = 2, blockAlign = (uint16)(channels * bits / 8);
+		fwrite ("RIFF\0\0\0\0WAVEfmt ", 1, 16, file);
+		put32 (16);  put16 (format);  put16 (channels);  put32 (rate);
+		put32 (rate * blockAlign);  put16 (blockAlign);  put16 ((uint16)bits);
+		fwrite ("data\0\0\0\0", 1, 8, file);
+		return true;
+	}
+
+	// float 或 double 缓冲；PCM 的削波和取整在输入精度上做，float 输入的结果与以前的 lrintf 相同
+	template <typename SampleType>
+	void write (const SampleType* l, const SampleType* r, int32 frames)
+	{
+		uint8 buffer[4096 * 2 * 8];
+		while (frames > 0)
+		{
+			int32 n = std::min<int32> (frames, 4096);
+			uint8* p = buffer;
+			for (int32 f = 0; f < n; f++)
+			{
+				p = encode (p, l[f]);
+				p = encode (p, r[f]);
+			}
+			fwrite (buffer, 1, p - buffer, file);
+			dataBytes += (uint32)(p - buffer);
+			l += n;  r += n;  frames -= n;
+		}
+	}
+
+	bool close ()
+	{
+		if (!file)
+			return true;
+		fseek (file, 4, SEEK_SET);  put32 (36 + dataBytes);
+		fseek (file, 40, SEEK_SET);  put32 (dataBytes);
+		bool ok = ferror (file) == 0;
+		fclose (file);
+		file = nullptr;
+		return ok;
+	}
+
+private:
+	template <typename SampleType>
+	uint8* encode (uint8* p, SampleType x)
+	{
+		if (bits == 64)
+		{
+			double d = (double)x;
+			uint64 v;
+			memcpy (&v, &d, 8);
+			for (int32 i = 0; i < 8; i++) *p++ = (uint8)(v >> (8 * i));
+			return p;
+		}
+		if (bits == 32)
+		{
+			float f = (float)x;
+			uint32 v;
+			memcpy (&v, &f, 4);
+			for (int32 i = 0; i < 4; i++) *p++ = (uint8)(v >> (8 * i));
+			return p;
+		}
+		x = std::min ((SampleType)1, std::max ((SampleType)-1, x));
+		int32 scale = bits == 16 ? 32767 : 8388607;
+		int32 v = (int32)std::lrint (x * (SampleType)scale);
+		for (int32 i = 0; i < bits / 8; i++) *p++ = (uint8)(v >> (8 * i));
+		return p;
+	}
+
+	void put16 (uint16 v) { uint8 b[2] = {(uint8)v, (uint8)(v >> 8)};  fwrite (b, 1, 2, file); }
+	void put32 (uint32 v) { uint8 b[4] = {(uint8)v, (uint8)(v >> 8), (uint8)(v >> 16), (uint8)(v >> 24)};  fwrite (b, 1, 4, file); }
+
+	FILE* file = nullptr;
+	int32 bits = 24;
+	uint32 dataBytes = 0;
+};
+
+}}} // namespaces